@@ -0,0 +1,325 @@
+#include "audit.h"
+
+#include <algorithm>
+#include <string>
+
+#include "bitmap.h"
+
+namespace {
+
+// Prints consecutive block or inode numbers as one "first-last" line
+class run_printer
+{
+public:
+    run_printer(std::ostream &report, const char *noun, const char *what, uint64_t &problems)
+        : report_(report), noun_(noun), what_(what), problems_(problems) {}
+    ~run_printer() { flush(); }
+
+    void add(uint64_t n)
+    {
+        if (count_ != 0 && first_ + count_ == n) {
+            count_++;
+            return;
+        }
+        flush();
+        first_ = n;
+        count_ = 1;
+    }
+
+private:
+    void flush()
+    {
+        if (count_ == 0) { return; }
+        report_ << "audit: " << noun_;
+        if (count_ == 1) {
+            report_ << " " << first_ << " is ";
+        } else {
+            report_ << "s " << first_ << "-" << first_ + count_ - 1 << " are ";
+        }
+        report_ << what_ << "\n";
+        problems_++;
+        count_ = 0;
+    }
+
+    std::ostream &report_;
+    const char *noun_;
+    const char *what_;
+    uint64_t &problems_;
+    uint64_t first_ = 0;
+    uint64_t count_ = 0;
+};
+
+// Calls `fn(i)` for every set bit of `word`
+template <typename F>
+void for_each_set_bit(uint64_t word, F &&fn)
+{
+    while (word != 0) {
+        fn(__builtin_ctzll(word));
+        word &= word - 1;
+    }
+}
+
+} // namespace
+
+bool audit_geometry_ok(const ext2_layout &layout, uint64_t image_size, std::ostream &report)
+{
+    const ext2_super_block &sb = *layout.sb;
+    // each group's bitmaps are one block
+    uint64_t bits_per_block = (uint64_t)layout.block_size * 8;
+    uint64_t image_blocks = image_size / layout.block_size;
+    uint64_t table_bytes = (uint64_t)sb.s_inodes_per_group * inode_size(sb);
+    bool ok = true;
+    if (sb.s_blocks_count > image_blocks) {
+        report << "audit: the superblock has " << sb.s_blocks_count << " blocks, the image only "
+               << image_blocks << "\n";
+        ok = false;
+    }
+    if (sb.s_blocks_per_group > bits_per_block) {
+        report << "audit: the superblock has " << sb.s_blocks_per_group
+               << " blocks per group, more than a block bitmap holds\n";
+        ok = false;
+    }
+    if (sb.s_inodes_per_group == 0 || sb.s_inodes_per_group > bits_per_block ||
+        table_bytes > (uint64_t)sb.s_blocks_per_group * layout.block_size) {
+        report << "audit: the superblock has " << sb.s_inodes_per_group
+               << " inodes per group, which don't fit in a group\n";
+        ok = false;
+    }
+    if (sb.s_inodes_count > (uint64_t)sb.s_inodes_per_group * layout.group_count) {
+        report << "audit: the superblock has " << sb.s_inodes_count << " inodes, more than its "
+               << layout.group_count << " groups hold\n";
+        ok = false;
+    }
+    if (!ok) { report << "audit: the superblock is inconsistent, nothing else was checked\n"; }
+    return ok;
+}
+
+uint64_t atomic_bitset::word_at(uint64_t i) const
+{
+    uint64_t w = i / 64, shift = i % 64;
+    if (w >= words_.size()) { return 0; }
+    uint64_t word = words_[w].load(std::memory_order_relaxed) >> shift;
+    if (shift != 0 && w + 1 < words_.size()) {
+        word |= words_[w + 1].load(std::memory_order_relaxed) << (64 - shift);
+    }
+    return word;
+}
+
+fs_audit::fs_audit(const ext2_layout &layout)
+    : layout_(layout), sb_(*layout.sb), blocks_(sb_.s_blocks_count),
+      inodes_used_((uint64_t)sb_.s_inodes_count + 1), inodes_named_((uint64_t)sb_.s_inodes_count + 1)
+{
+    uint32_t gdt_blocks = ((uint64_t)layout.group_count * sizeof(ext2_group_desc) + layout.block_size - 1) / layout.block_size;
+    uint32_t inode_table_blocks = ((uint64_t)sb_.s_inodes_per_group * inode_size(sb_) + layout.block_size - 1) / layout.block_size;
+    for (int group = 0; group < layout.group_count; group++) {
+        if (has_superblock(sb_, group)) {
+            uint32_t first = group_first_block(sb_, group);
+            for (uint32_t b = 0; b <= gdt_blocks; b++) { add_block(first + b, 0); }
+        }
+        const ext2_group_desc &bgd = layout.group_desc(group);
+        add_block(bgd.bg_block_bitmap, 0);
+        add_block(bgd.bg_inode_bitmap, 0);
+        for (uint32_t b = 0; b < inode_table_blocks; b++) { add_block(bgd.bg_inode_table + b, 0); }
+    }
+    // the reserved inodes are always marked in use, whether they are or not
+    uint32_t first_ino = sb_.s_rev_level == 0 ? EXT2_GOOD_OLD_FIRST_INO : sb_.s_first_ino;
+    for (uint32_t ino = 1; ino < first_ino && ino <= sb_.s_inodes_count; ino++) { inodes_used_.set(ino); }
+}
+
+void fs_audit::add_problem(problem p)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    problems_.push_back(p);
+}
+
+void fs_audit::add_inode(uint32_t inode_num, const ext2_inode &inode)
+{
+    if (inode_num == 0 || inode_num > sb_.s_inodes_count) { return; }
+    inodes_used_.set(inode_num);
+    if (inode.i_links_count != 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        links_[inode_num].link_count = inode.i_links_count;
+    }
+}
+
+void fs_audit::add_block(uint32_t block, uint32_t owner)
+{
+    if (block < sb_.s_first_data_block || block >= sb_.s_blocks_count) {
+        add_problem({block, owner, problem::block_out_of_range});
+    } else if (blocks_.set(block)) {
+        add_problem({block, owner, problem::duplicate_block});
+    }
+}
+
+void fs_audit::add_dirent(uint32_t parent, const ext2_dir_entry &entry)
+{
+    if (entry.inode > sb_.s_inodes_count) {
+        add_problem({entry.inode, parent, problem::inode_out_of_range});
+    } else if (inodes_named_.set(entry.inode)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        links_[entry.inode].extra_entries++;
+    }
+}
+
+uint64_t fs_audit::finish(ext2_image &image, std::ostream &report)
+{
+    uint64_t count = 0;
+    // the scan may run on several threads, sort what they found
+    std::sort(problems_.begin(), problems_.end(), [](const problem &a, const problem &b) {
+        return a.kind != b.kind ? a.kind < b.kind : a.block_or_inode < b.block_or_inode;
+    });
+    for (const problem &p : problems_) {
+        switch (p.kind) {
+            case problem::duplicate_block:
+                report << "audit: block " << p.block_or_inode << " of "
+                       << (p.owner == 0 ? std::string("the filesystem metadata") : "inode " + std::to_string(p.owner))
+                       << " is already in use by another owner\n";
+                break;
+            case problem::block_out_of_range:
+                report << "audit: inode " << p.owner << " refers to block " << p.block_or_inode
+                       << " outside the filesystem\n";
+                break;
+            case problem::inode_out_of_range:
+                report << "audit: directory " << p.owner << " has an entry for inode " << p.block_or_inode
+                       << " outside the filesystem\n";
+                break;
+        }
+        count++;
+    }
+
+    // the block and inode bitmaps against what the inodes refer to
+    uint64_t free_blocks = 0, free_inodes = 0;
+    for (int group = 0; group < layout_.group_count; group++) {
+        const ext2_group_desc &bgd = layout_.group_desc(group);
+        uint64_t first_block = group_first_block(sb_, group);
+        uint32_t blocks = first_block >= sb_.s_blocks_count ? 0 :
+                          std::min<uint64_t>(sb_.s_blocks_per_group, sb_.s_blocks_count - first_block);
+        image_view bitmap = image.view((uint64_t)bgd.bg_block_bitmap * layout_.block_size, (blocks + 7) / 8);
+        if (!bitmap) {
+            report << "audit: could not read the block bitmap of group " << group << "\n";
+            count++;
+            continue;
+        }
+        uint32_t group_free = 0;
+        {
+            run_printer unreferenced(report, "block", "marked in use but not used", count);
+            run_printer marked_free(report, "block", "used but marked free", count);
+            for (uint32_t bit = 0; bit < blocks; bit += 64) {
+                uint64_t valid = blocks - bit >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << (blocks - bit)) - 1;
+                uint64_t on_disk = bitmap_word(bitmap.data(), blocks, bit) & valid;
+                uint64_t used = blocks_.word_at(first_block + bit) & valid;
+                group_free += __builtin_popcountll(~on_disk & valid);
+                if (on_disk == used) { continue; }
+                for_each_set_bit(on_disk & ~used, [&](int i) { unreferenced.add(first_block + bit + i); });
+                for_each_set_bit(used & ~on_disk, [&](int i) { marked_free.add(first_block + bit + i); });
+            }
+        }
+        if (group_free != bgd.bg_free_blocks_count) {
+            report << "audit: group " << group << " has " << group_free
+                   << " free blocks in its bitmap, its descriptor says " << bgd.bg_free_blocks_count << "\n";
+            count++;
+        }
+        free_blocks += group_free;
+
+        uint64_t first_inode = (uint64_t)sb_.s_inodes_per_group * group + 1;
+        uint32_t inodes = group_inode_count(sb_, group);
+        bitmap = image.view((uint64_t)bgd.bg_inode_bitmap * layout_.block_size, (inodes + 7) / 8);
+        if (!bitmap) {
+            report << "audit: could not read the inode bitmap of group " << group << "\n";
+            count++;
+            continue;
+        }
+        group_free = 0;
+        {
+            run_printer unused(report, "inode", "marked in use but not used", count);
+            run_printer marked_free(report, "inode", "used but marked free", count);
+            for (uint32_t bit = 0; bit < inodes; bit += 64) {
+                uint64_t valid = inodes - bit >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << (inodes - bit)) - 1;
+                uint64_t on_disk = bitmap_word(bitmap.data(), inodes, bit) & valid;
+                uint64_t used = inodes_used_.word_at(first_inode + bit) & valid;
+                group_free += __builtin_popcountll(~on_disk & valid);
+                if (on_disk == used) { continue; }
+                for_each_set_bit(on_disk & ~used, [&](int i) { unused.add(first_inode + bit + i); });
+                for_each_set_bit(used & ~on_disk, [&](int i) { marked_free.add(first_inode + bit + i); });
+            }
+        }
+        if (group_free != bgd.bg_free_inodes_count) {
+            report << "audit: group " << group << " has " << group_free
+                   << " free inodes in its bitmap, its descriptor says " << bgd.bg_free_inodes_count << "\n";
+            count++;
+        }
+        free_inodes += group_free;
+    }
+    if (free_blocks != sb_.s_free_blocks_count) {
+        report << "audit: the bitmaps have " << free_blocks << " free blocks, the superblock says "
+               << sb_.s_free_blocks_count << "\n";
+        count++;
+    }
+    if (free_inodes != sb_.s_free_inodes_count) {
+        report << "audit: the bitmaps have " << free_inodes << " free inodes, the superblock says "
+               << sb_.s_free_inodes_count << "\n";
+        count++;
+    }
+
+    // Link counts against directory entries. An inode that is used and named
+    // once can only be wrong if it is in `links_`, one that is only used or
+    // only named always is.
+    uint32_t first_ino = sb_.s_rev_level == 0 ? EXT2_GOOD_OLD_FIRST_INO : sb_.s_first_ino;
+    auto checked = [&](uint64_t ino) { return ino == EXT2_ROOT_INO || ino >= first_ino; };
+    std::vector<uint32_t> wrong;
+    for (uint64_t ino = 0; ino <= sb_.s_inodes_count; ino += 64) {
+        uint64_t diff = inodes_used_.word_at(ino) ^ inodes_named_.word_at(ino);
+        for_each_set_bit(diff, [&](int i) {
+            if (checked(ino + i)) { wrong.push_back(ino + i); }
+        });
+    }
+    for (const auto &entry : links_) {
+        uint32_t ino = entry.first;
+        if (checked(ino) && inodes_used_.test(ino) && inodes_named_.test(ino) &&
+            entry.second.link_count != 1 + entry.second.extra_entries) {
+            wrong.push_back(ino);
+        }
+    }
+    std::sort(wrong.begin(), wrong.end());
+    for (uint32_t ino : wrong) {
+        auto it = links_.find(ino);
+        uint32_t link_count = !inodes_used_.test(ino) ? 0 : it == links_.end() ? 1 : it->second.link_count;
+        uint32_t entries = !inodes_named_.test(ino) ? 0 : it == links_.end() ? 1 : 1 + it->second.extra_entries;
+        report << "audit: inode " << ino << " has link count " << link_count << " but " << entries
+               << " directory entries\n";
+        count++;
+    }
+    report << "audit: " << count << " problems found\n";
+    report.flush();
+    return count;
+}
+
+void audit_writer::inode(uint32_t inode_num, const ext2_inode &inode)
+{
+    audit_.add_inode(inode_num, inode);
+    char type = inode_file_type(inode);
+    // only regular files and directories have their block maps walked; fast
+    // symbolic links keep the target in `i_block` and use no blocks
+    int pointers = 0;
+    if ((type == 'f' || type == 'd') && !extents_) {
+        pointers = EXT2_N_BLOCKS;
+    } else if (type == 's' && inode.i_blocks != 0) {
+        pointers = EXT2_NDIR_BLOCKS;
+    }
+    for (int i = 0; i < pointers; i++) {
+        if (inode.i_block[i] != 0) { audit_.add_block(inode.i_block[i], inode_num); }
+    }
+    out_.inode(inode_num, inode);
+}
+
+void audit_writer::extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) { audit_.add_block(physical_start + i, inode_num); }
+    out_.extent(inode_num, logical_start, physical_start, length);
+}
+
+void audit_writer::meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++) { audit_.add_block(physical_start + i, inode_num); }
+    out_.meta_extent(inode_num, physical_start, length);
+}
@@ -0,0 +1,144 @@
+#ifndef EXT2_AUDIT_H
+#define EXT2_AUDIT_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "filesystem.h"
+#include "records.h"
+
+// A fixed size set of bits that several threads can set at once
+class atomic_bitset
+{
+public:
+    explicit atomic_bitset(uint64_t bits) : words_((bits + 63) / 64) {}
+
+    // Sets bit `i` and returns whether it was already set
+    bool set(uint64_t i)
+    {
+        uint64_t mask = (uint64_t)1 << (i % 64);
+        return (words_[i / 64].fetch_or(mask, std::memory_order_relaxed) & mask) != 0;
+    }
+    bool test(uint64_t i) const
+    {
+        return (words_[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1;
+    }
+    // The 64 bits starting at bit `i`, which doesn't have to be a multiple of 64.
+    // Bits past the end read as 0.
+    uint64_t word_at(uint64_t i) const;
+
+private:
+    std::vector<std::atomic<uint64_t>> words_;
+};
+
+// `--audit`: an e2fsck style consistency check made from the records of the
+// scan itself. Every block an inode (or the filesystem's own metadata) refers
+// to is set in a bitset of one bit per block, which also catches blocks with
+// more than one owner, and the directory entries pointing at each inode are
+// counted. `finish` then compares both against the on-disk bitmaps, the link
+// counts and the free counts of the group descriptors and the superblock.
+// Inodes take two bits each, plus a map entry for the directories and hard
+// linked files whose link count isn't 1.
+class fs_audit
+{
+public:
+    // Marks the superblocks, group descriptor tables, bitmaps and inode tables.
+    // The layout must have passed `audit_geometry_ok`.
+    explicit fs_audit(const ext2_layout &layout);
+
+    // An inode in use (the INODE records of the scan)
+    void add_inode(uint32_t inode_num, const ext2_inode &inode);
+    // A block that belongs to `owner` (0 for the filesystem's own metadata)
+    void add_block(uint32_t block, uint32_t owner);
+    void add_dirent(uint32_t parent, const ext2_dir_entry &entry);
+
+    // Compares what the scan found with the on-disk bitmaps and counts, prints
+    // every inconsistency to `report` and returns how many there were
+    uint64_t finish(ext2_image &image, std::ostream &report);
+
+private:
+    // a reference that can't be checked against the bitmaps
+    struct problem
+    {
+        uint32_t block_or_inode;
+        uint32_t owner;
+        enum { duplicate_block, block_out_of_range, inode_out_of_range } kind;
+    };
+    // link counts and directory entries of an inode whose link count isn't 1
+    // or that is named by more than one entry
+    struct links
+    {
+        uint32_t link_count = 1;
+        // entries beyond the first
+        uint32_t extra_entries = 0;
+    };
+
+    void add_problem(problem p);
+
+    const ext2_layout &layout_;
+    const ext2_super_block &sb_;
+    atomic_bitset blocks_;
+    atomic_bitset inodes_used_;
+    // named by at least one directory entry
+    atomic_bitset inodes_named_;
+    std::mutex mutex_;
+    std::unordered_map<uint32_t, links> links_;
+    std::vector<problem> problems_;
+};
+
+// Whether the block and inode counts of the superblock agree with the group
+// geometry and the `image_size`, so an `fs_audit` can be sized from them.
+// Prints what doesn't to `report` as audit problems.
+bool audit_geometry_ok(const ext2_layout &layout, uint64_t image_size, std::ostream &report);
+
+// Forwards every record to `out` and feeds the blocks, inodes and directory
+// entries they describe to an `fs_audit`. With `extents` the block maps are
+// taken from the EXTENT/META_EXTENT records, otherwise from the block
+// pointers of the INODE records and the INDIRECT records.
+class audit_writer : public record_writer
+{
+public:
+    audit_writer(fs_audit &audit, record_writer &out, bool extents)
+        : audit_(audit), out_(out), extents_(extents) {}
+
+    void superblock(const ext2_super_block &sb, uint32_t block_size) override { out_.superblock(sb, block_size); }
+    void group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+               const ext2_group_desc &bgd) override
+    {
+        out_.group(group, blocks_in_group, inodes_in_group, bgd);
+    }
+    void bfree(uint32_t block) override { out_.bfree(block); }
+    void ifree(uint32_t inode) override { out_.ifree(inode); }
+    void bfree_range(uint32_t first, uint32_t count) override { out_.bfree_range(first, count); }
+    void ifree_range(uint32_t first, uint32_t count) override { out_.ifree_range(first, count); }
+    void inode(uint32_t inode_num, const ext2_inode &inode) override;
+    void dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry) override
+    {
+        audit_.add_dirent(parent, entry);
+        out_.dirent(parent, offset, entry);
+    }
+    void indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                  uint32_t ind_block, uint32_t block) override
+    {
+        audit_.add_block(block, inode_num);
+        out_.indirect(inode_num, level, logical_offset, ind_block, block);
+    }
+    void extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                uint32_t length) override;
+    void meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length) override;
+    void message(std::string_view line) override { out_.message(line); }
+
+    void append(record_writer &other) override { out_.append(other); }
+    void flush() override { out_.flush(); }
+
+private:
+    fs_audit &audit_;
+    record_writer &out_;
+    bool extents_;
+};
+
+#endif // EXT2_AUDIT_H
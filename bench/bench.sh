@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+# Benchmarks `p4exp1` on synthetic images made by `mkext2img` (run with `make bench`).
+#
+# Every profile's image is generated into $BENCH_DIR (default /tmp/ext2_bench),
+# scanned once to warm the page cache and then scanned $BENCH_RUNS times (default 3).
+# One line per run is appended to $BENCH_RESULTS (default bench/results.csv):
+#   date,commit,profile,flags,image_mb,inodes,seconds,mb_per_s,inodes_per_s,peak_rss_kb,exit_status
+# $BENCH_PROFILES picks the profiles to run (default: all but big-4k),
+# $P4EXP1_FLAGS is passed to `p4exp1` (e.g. "-j 4 --free-ranges").
+
+cd "$(dirname "$0")/.." || exit 1
+
+BENCH_DIR=${BENCH_DIR:-/tmp/ext2_bench}
+BENCH_RUNS=${BENCH_RUNS:-3}
+BENCH_RESULTS=${BENCH_RESULTS:-bench/results.csv}
+BENCH_PROFILES=${BENCH_PROFILES:-"small-1k tree-2k wide-4k"}
+
+# name: image size, block size, files, fan-out, file size, large files, large file size
+declare -A PROFILES=(
+    # the large file needs triple indirect blocks with 1K blocks
+    [small-1k]="128M 1024 2000 50 4K 1 70M"
+    # many small directories, the large file needs triple indirect blocks with 2K blocks
+    [tree-2k]="1G 2048 50000 20 2K 1 600M"
+    # wide directories, the large files need double indirect blocks
+    [wide-4k]="8G 4096 200000 500 16K 2 1G"
+    # tens of GB, the large files need triple indirect blocks with 4K blocks
+    [big-4k]="32G 4096 500000 100 4K 2 5G"
+)
+
+mkdir -p "$BENCH_DIR" || exit 1
+if [ ! -f "$BENCH_RESULTS" ]; then
+    echo "date,commit,profile,flags,image_mb,inodes,seconds,mb_per_s,inodes_per_s,peak_rss_kb,exit_status" > "$BENCH_RESULTS"
+fi
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ -n "$(git status --porcelain --untracked-files=no 2>/dev/null)" ]; then
+    commit="$commit-dirty"
+fi
+
+for profile in $BENCH_PROFILES; do
+    if [ -z "${PROFILES[$profile]}" ]; then
+        echo "unknown profile $profile" >&2
+        exit 1
+    fi
+    read -r size block_size files fanout file_size large large_size <<< "${PROFILES[$profile]}"
+    image="$BENCH_DIR/$profile.img"
+    summary=$(bench/mkext2img -s "$size" -b "$block_size" -n "$files" -f "$fanout" \
+              -S "$file_size" -l "$large" -L "$large_size" "$image") || exit 1
+    inodes=${summary##*inodes_used=}
+    bytes=$(stat -c %s "$image")
+    echo "$profile: $summary"
+
+    # shellcheck disable=SC2086
+    ./p4exp1 $P4EXP1_FLAGS "$image" > /dev/null
+    for ((run = 0; run < BENCH_RUNS; run++)); do
+        # shellcheck disable=SC2086
+        result=$(bench/bench_run "$bytes" "$inodes" ./p4exp1 $P4EXP1_FLAGS "$image") || exit 1
+        echo "  $result"
+        echo "$(date -u +%Y-%m-%dT%H:%M:%SZ),$commit,$profile,$P4EXP1_FLAGS,$((bytes >> 20)),$inodes,$result" >> "$BENCH_RESULTS"
+    done
+    rm -f "$image"
+done
@@ -0,0 +1,51 @@
+// bench_run: runs a command once and reports how long it took and how much memory it used.
+//
+// usage: bench_run <image bytes> <inodes> <command> [args...]
+//
+// The command's stdout goes to /dev/null. Prints one CSV line:
+// seconds,mb_per_s,inodes_per_s,peak_rss_kb,exit_status
+// where the throughputs are the image size and the inode count divided by
+// the wall clock time, and the peak RSS comes from wait4's rusage.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <image bytes> <inodes> <command> [args...]\n", argv[0]);
+        return 1;
+    }
+    double bytes = strtod(argv[1], nullptr);
+    double inodes = strtod(argv[2], nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) { dup2(null_fd, STDOUT_FILENO); }
+        execvp(argv[3], argv + 3);
+        perror(argv[3]);
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    printf("%.3f,%.1f,%.0f,%ld,%d\n", seconds, bytes / (1 << 20) / seconds, inodes / seconds,
+           usage.ru_maxrss, exit_status);
+    return 0;
+}
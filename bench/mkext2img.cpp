@@ -0,0 +1,478 @@
+// mkext2img: writes a synthetic ext2 image for benchmarking p4exp1.
+//
+// usage: mkext2img [-s SIZE] [-b BLOCK_SIZE] [-n FILES] [-f FANOUT] [-S FILE_SIZE]
+//                  [-l LARGE_FILES] [-L LARGE_SIZE] <out.img>
+//
+// SIZE, FILE_SIZE and LARGE_SIZE accept K, M and G suffixes. FILES small files
+// are spread over a tree of directories where every directory holds at most
+// FANOUT files and FANOUT subdirectories. LARGE_FILES files of LARGE_SIZE bytes
+// are created in the root directory; make them large enough and they use the
+// double and triple indirect blocks.
+//
+// The result is a revision 1 ext2 filesystem without optional features that
+// passes `e2fsck -fn`. Only metadata (superblocks, descriptors, bitmaps, inode
+// tables, directory and indirect blocks) is written, file data is left as
+// holes, so even an image of tens of GB takes little space and time to create.
+// On success a single `blocks=... inodes_used=...` line is printed.
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../ext2_fs.h"
+
+namespace {
+
+const uint32_t inode_size = 128;
+const uint32_t first_ino = 11;
+const uint32_t lost_found_ino = 11;
+// fixed so that the same parameters always give the same image
+const uint32_t timestamp = 1700000000;
+const uint32_t feature_ro_compat_large_file = 0x0002;
+
+[[noreturn]] void fail(const std::string &message)
+{
+    fprintf(stderr, "mkext2img: %s\n", message.c_str());
+    exit(1);
+}
+
+uint64_t parse_size(const char *arg)
+{
+    char *end;
+    uint64_t value = strtoull(arg, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': value <<= 10; break;
+        case 'M': case 'm': value <<= 20; break;
+        case 'G': case 'g': value <<= 30; break;
+        case '\0': break;
+        default: fail(std::string("bad size ") + arg);
+    }
+    return value;
+}
+
+// Combines writes to consecutive offsets into large pwrite calls
+class image_writer
+{
+public:
+    explicit image_writer(int fd) : fd_(fd) {}
+    ~image_writer() { flush(); }
+
+    void write(uint64_t offset, const void *data, size_t len)
+    {
+        if (!buffer_.empty() && (offset != offset_ + buffer_.size() || buffer_.size() + len > capacity)) {
+            flush();
+        }
+        if (buffer_.empty()) { offset_ = offset; }
+        buffer_.append((const char *)data, len);
+    }
+
+    void flush()
+    {
+        const char *data = buffer_.data();
+        size_t len = buffer_.size();
+        uint64_t offset = offset_;
+        while (len > 0) {
+            ssize_t n = pwrite(fd_, data, len, offset);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                fail(std::string("write failed: ") + strerror(errno));
+            }
+            data += n;
+            len -= n;
+            offset += n;
+        }
+        buffer_.clear();
+    }
+
+private:
+    static const size_t capacity = 4 << 20;
+    int fd_;
+    uint64_t offset_ = 0;
+    std::string buffer_;
+};
+
+struct parameters
+{
+    uint64_t size = 64 << 20;
+    uint32_t block_size = 1024;
+    uint32_t files = 1000;
+    uint32_t fanout = 32;
+    uint64_t file_size = 4096;
+    uint32_t large_files = 0;
+    uint64_t large_size = 0;
+};
+
+class fs_builder
+{
+public:
+    fs_builder(int fd, const parameters &p)
+        : p_(p), bs_(p.block_size), tables_(fd), blocks_(fd)
+    {
+        dirs_ = p.files == 0 ? 1 : (p.files + p.fanout - 1) / p.fanout;
+        uint64_t inodes_needed = first_ino - 1 + dirs_ + (uint64_t)p.files + p.large_files;
+
+        first_data_block_ = bs_ == 1024 ? 1 : 0;
+        bpg_ = 8 * bs_;
+        uint64_t blocks = p.size / bs_;
+        if (blocks > UINT32_MAX) { fail("image too large for this block size"); }
+        blocks_count_ = blocks;
+        groups_ = (blocks_count_ - first_data_block_ + bpg_ - 1) / bpg_;
+        if (groups_ == 0) { fail("image too small"); }
+        gdt_blocks_ = (groups_ * sizeof(ext2_group_desc) + bs_ - 1) / bs_;
+
+        size_inode_tables(inodes_needed);
+        // drop a last group that is too small to hold its own metadata
+        if (groups_ > 1 && group_blocks(groups_ - 1) < overhead() + 16) {
+            groups_--;
+            blocks_count_ = group_first(groups_);
+            gdt_blocks_ = (groups_ * sizeof(ext2_group_desc) + bs_ - 1) / bs_;
+            size_inode_tables(inodes_needed);
+        }
+        if (group_blocks(0) <= overhead()) { fail("image too small"); }
+        inodes_count_ = ipg_ * groups_;
+        if (inodes_needed > inodes_count_) { fail("too many files for this image size"); }
+
+        block_bitmaps_.assign(groups_, std::vector<uint8_t>(bs_, 0));
+        inode_bitmaps_.assign(groups_, std::vector<uint8_t>(bs_, 0));
+        free_blocks_.assign(groups_, 0);
+        free_inodes_.assign(groups_, ipg_);
+        used_dirs_.assign(groups_, 0);
+        for (uint32_t g = 0; g < groups_; g++) {
+            uint32_t n = group_blocks(g);
+            free_blocks_[g] = n - overhead();
+            for (uint32_t b = 0; b < overhead(); b++) { set_bit(block_bitmaps_[g], b); }
+            // bits past the end of the group are marked in use
+            for (uint32_t b = n; b < 8 * bs_; b++) { set_bit(block_bitmaps_[g], b); }
+            for (uint32_t i = ipg_; i < 8 * bs_; i++) { set_bit(inode_bitmaps_[g], i); }
+        }
+        // reserved inodes, except the root directory which is written later
+        for (uint32_t ino = 1; ino < first_ino; ino++) {
+            if (ino != EXT2_ROOT_INO) { use_inode(ino, false); }
+        }
+        next_block_ = group_first(0) + overhead();
+    }
+
+    void build()
+    {
+        uint32_t per_block = bs_ / sizeof(__u32);
+        uint64_t max_blocks = EXT2_NDIR_BLOCKS + per_block + (uint64_t)per_block * per_block +
+                              (uint64_t)per_block * per_block * per_block;
+        if ((p_.large_size + bs_ - 1) / bs_ > max_blocks || (p_.file_size + bs_ - 1) / bs_ > max_blocks) {
+            fail("file size too large for this block size");
+        }
+
+        // directory k (0 is the root) has subdirectories k*fanout+1 .. k*fanout+fanout
+        // and files k*fanout .. k*fanout+fanout-1
+        for (uint32_t k = 0; k < dirs_; k++) {
+            std::vector<std::pair<std::string, uint32_t>> entries;
+            entries.push_back({".", dir_ino(k)});
+            entries.push_back({"..", k == 0 ? EXT2_ROOT_INO : dir_ino((k - 1) / p_.fanout)});
+            uint32_t subdirs = 0;
+            if (k == 0) {
+                entries.push_back({"lost+found", lost_found_ino});
+                subdirs++;
+                for (uint32_t l = 0; l < p_.large_files; l++) {
+                    entries.push_back({"large" + std::to_string(l), large_ino(l)});
+                }
+            }
+            for (uint64_t c = (uint64_t)k * p_.fanout + 1; c <= (uint64_t)k * p_.fanout + p_.fanout && c < dirs_; c++) {
+                entries.push_back({"d" + std::to_string(c), dir_ino(c)});
+                subdirs++;
+            }
+            for (uint64_t f = (uint64_t)k * p_.fanout; f < (uint64_t)k * p_.fanout + p_.fanout && f < p_.files; f++) {
+                entries.push_back({"f" + std::to_string(f), file_ino(f)});
+            }
+            make_directory(dir_ino(k), entries, 2 + subdirs);
+            if (k == 0) {
+                make_directory(lost_found_ino, {{".", lost_found_ino}, {"..", EXT2_ROOT_INO}}, 2);
+            }
+        }
+        for (uint32_t f = 0; f < p_.files; f++) {
+            make_file(file_ino(f), p_.file_size);
+        }
+        for (uint32_t l = 0; l < p_.large_files; l++) {
+            make_file(large_ino(l), p_.large_size);
+        }
+        finish();
+    }
+
+private:
+    // 5% spare inodes, rounded up to whole inode table blocks
+    void size_inode_tables(uint64_t inodes_needed)
+    {
+        uint32_t per_block = bs_ / inode_size;
+        uint64_t ipg = (inodes_needed + inodes_needed / 20 + groups_ - 1) / groups_;
+        ipg = (ipg + per_block - 1) / per_block * per_block;
+        if (ipg < per_block) { ipg = per_block; }
+        if (ipg > bpg_) { fail("too many files for this image size"); }
+        ipg_ = ipg;
+        itable_blocks_ = ipg_ * inode_size / bs_;
+    }
+
+    uint32_t dir_ino(uint64_t k) const { return k == 0 ? EXT2_ROOT_INO : first_ino + k; }
+    uint32_t file_ino(uint64_t f) const { return first_ino + dirs_ + f; }
+    uint32_t large_ino(uint64_t l) const { return first_ino + dirs_ + p_.files + l; }
+
+    uint32_t group_first(uint32_t g) const { return first_data_block_ + g * bpg_; }
+    uint32_t group_blocks(uint32_t g) const
+    {
+        uint64_t end = (uint64_t)group_first(g) + bpg_;
+        return (end > blocks_count_ ? blocks_count_ : end) - group_first(g);
+    }
+    // superblock, descriptors, two bitmaps and the inode table at the start of every group
+    uint32_t overhead() const { return 1 + gdt_blocks_ + 2 + itable_blocks_; }
+    uint32_t block_bitmap(uint32_t g) const { return group_first(g) + 1 + gdt_blocks_; }
+    uint32_t inode_bitmap(uint32_t g) const { return block_bitmap(g) + 1; }
+    uint32_t inode_table(uint32_t g) const { return block_bitmap(g) + 2; }
+
+    static void set_bit(std::vector<uint8_t> &bitmap, uint32_t bit) { bitmap[bit / 8] |= 1 << (bit % 8); }
+
+    // Allocates the next free block; blocks are handed out in disk order
+    uint32_t alloc_block()
+    {
+        while (true) {
+            if (next_block_ >= blocks_count_) { fail("image too small for the requested files"); }
+            uint32_t g = (next_block_ - first_data_block_) / bpg_;
+            uint32_t index = next_block_ - group_first(g);
+            if (index < overhead()) {
+                next_block_ = group_first(g) + overhead();
+                continue;
+            }
+            set_bit(block_bitmaps_[g], index);
+            free_blocks_[g]--;
+            return next_block_++;
+        }
+    }
+
+    void use_inode(uint32_t ino, bool directory)
+    {
+        uint32_t g = (ino - 1) / ipg_;
+        set_bit(inode_bitmaps_[g], (ino - 1) % ipg_);
+        free_inodes_[g]--;
+        if (directory) { used_dirs_[g]++; }
+    }
+
+    void write_inode(uint32_t ino, const ext2_inode &inode, bool directory)
+    {
+        use_inode(ino, directory);
+        uint32_t g = (ino - 1) / ipg_;
+        uint64_t pos = (uint64_t)inode_table(g) * bs_ + (uint64_t)((ino - 1) % ipg_) * inode_size;
+        tables_.write(pos, &inode, sizeof(inode));
+    }
+
+    // Allocates the indirect block of `level` and the blocks below it, taking
+    // data blocks from `left`. Returns the indirect block's number.
+    uint32_t map_indirect(int level, uint64_t &left, uint64_t &meta, std::vector<uint32_t> *data)
+    {
+        uint32_t block = alloc_block();
+        meta++;
+        std::vector<__u32> pointers(bs_ / sizeof(__u32), 0);
+        for (size_t i = 0; i < pointers.size() && left > 0; i++) {
+            if (level == 1) {
+                pointers[i] = alloc_block();
+                left--;
+                if (data != nullptr) { data->push_back(pointers[i]); }
+            } else {
+                pointers[i] = map_indirect(level - 1, left, meta, data);
+            }
+        }
+        blocks_.write((uint64_t)block * bs_, pointers.data(), bs_);
+        return block;
+    }
+
+    // Allocates `count` data blocks for `inode` the way ext2 lays them out, each
+    // indirect block just before the blocks it maps. Appends the data blocks to `data`.
+    void map_blocks(ext2_inode &inode, uint64_t count, std::vector<uint32_t> *data)
+    {
+        uint64_t left = count;
+        uint64_t meta = 0;
+        for (int i = 0; i < EXT2_NDIR_BLOCKS && left > 0; i++, left--) {
+            inode.i_block[i] = alloc_block();
+            if (data != nullptr) { data->push_back(inode.i_block[i]); }
+        }
+        for (int level = 1; level <= 3 && left > 0; level++) {
+            inode.i_block[EXT2_IND_BLOCK + level - 1] = map_indirect(level, left, meta, data);
+        }
+        inode.i_blocks = (count + meta) * (bs_ / 512);
+    }
+
+    static ext2_inode new_inode(uint16_t mode, uint16_t links)
+    {
+        ext2_inode inode;
+        memset(&inode, 0, sizeof(inode));
+        inode.i_mode = mode;
+        inode.i_links_count = links;
+        inode.i_atime = inode.i_ctime = inode.i_mtime = timestamp;
+        return inode;
+    }
+
+    void make_directory(uint32_t ino, const std::vector<std::pair<std::string, uint32_t>> &entries,
+                        uint16_t links)
+    {
+        // pack the entries into blocks; the last entry of a block takes up the rest of it
+        std::string content;
+        size_t block_start = 0;
+        size_t last_entry = 0;
+        for (const auto &entry : entries) {
+            size_t len = (offsetof(ext2_dir_entry, name) + entry.first.size() + 3) & ~(size_t)3;
+            if (content.size() + len > block_start + bs_) {
+                ext2_dir_entry *last = (ext2_dir_entry *)&content[last_entry];
+                last->rec_len += block_start + bs_ - content.size();
+                content.resize(block_start + bs_, '\0');
+                block_start = content.size();
+            }
+            last_entry = content.size();
+            content.resize(content.size() + len, '\0');
+            ext2_dir_entry *d = (ext2_dir_entry *)&content[last_entry];
+            d->inode = entry.second;
+            d->rec_len = len;
+            d->name_len = entry.first.size();
+            memcpy(d->name, entry.first.data(), entry.first.size());
+        }
+        ext2_dir_entry *last = (ext2_dir_entry *)&content[last_entry];
+        last->rec_len += block_start + bs_ - content.size();
+        content.resize(block_start + bs_, '\0');
+
+        ext2_inode inode = new_inode(EXT2_I_IFDIR | 0755, links);
+        inode.i_size = content.size();
+        std::vector<uint32_t> data;
+        map_blocks(inode, content.size() / bs_, &data);
+        for (size_t i = 0; i < data.size(); i++) {
+            blocks_.write((uint64_t)data[i] * bs_, content.data() + i * bs_, bs_);
+        }
+        write_inode(ino, inode, true);
+    }
+
+    void make_file(uint32_t ino, uint64_t size)
+    {
+        ext2_inode inode = new_inode(EXT2_I_IFREG | 0644, 1);
+        inode.i_size = size;
+        inode.i_dir_acl = size >> 32;
+        if (size >= (1ULL << 31)) { large_file_ = true; }
+        map_blocks(inode, (size + bs_ - 1) / bs_, nullptr);
+        write_inode(ino, inode, false);
+    }
+
+    void finish()
+    {
+        std::vector<ext2_group_desc> gdt(gdt_blocks_ * bs_ / sizeof(ext2_group_desc));
+        memset(gdt.data(), 0, gdt.size() * sizeof(ext2_group_desc));
+        uint64_t free_blocks = 0, free_inodes = 0;
+        for (uint32_t g = 0; g < groups_; g++) {
+            gdt[g].bg_block_bitmap = block_bitmap(g);
+            gdt[g].bg_inode_bitmap = inode_bitmap(g);
+            gdt[g].bg_inode_table = inode_table(g);
+            gdt[g].bg_free_blocks_count = free_blocks_[g];
+            gdt[g].bg_free_inodes_count = free_inodes_[g];
+            gdt[g].bg_used_dirs_count = used_dirs_[g];
+            free_blocks += free_blocks_[g];
+            free_inodes += free_inodes_[g];
+            blocks_.write((uint64_t)block_bitmap(g) * bs_, block_bitmaps_[g].data(), bs_);
+            blocks_.write((uint64_t)inode_bitmap(g) * bs_, inode_bitmaps_[g].data(), bs_);
+        }
+
+        ext2_super_block sb;
+        memset(&sb, 0, sizeof(sb));
+        sb.s_inodes_count = inodes_count_;
+        sb.s_blocks_count = blocks_count_;
+        sb.s_free_blocks_count = free_blocks;
+        sb.s_free_inodes_count = free_inodes;
+        sb.s_first_data_block = first_data_block_;
+        sb.s_log_block_size = bs_ == 1024 ? 0 : bs_ == 2048 ? 1 : 2;
+        sb.s_log_frag_size = sb.s_log_block_size;
+        sb.s_blocks_per_group = bpg_;
+        sb.s_frags_per_group = bpg_;
+        sb.s_inodes_per_group = ipg_;
+        sb.s_wtime = sb.s_lastcheck = timestamp;
+        sb.s_max_mnt_count = -1;
+        sb.s_magic = 0xEF53;
+        sb.s_state = EXT2_VALID_FS;
+        sb.s_errors = 1;
+        sb.s_rev_level = 1;
+        sb.s_first_ino = first_ino;
+        sb.s_inode_size = inode_size;
+        sb.s_feature_ro_compat = large_file_ ? feature_ro_compat_large_file : 0;
+        // without the sparse_super feature every group keeps a backup of the
+        // superblock and the descriptor table
+        for (uint32_t g = 0; g < groups_; g++) {
+            sb.s_block_group_nr = g;
+            uint64_t sb_pos = g == 0 ? 1024 : (uint64_t)group_first(g) * bs_;
+            blocks_.write(sb_pos, &sb, sizeof(sb));
+            blocks_.write((uint64_t)(group_first(g) + 1) * bs_, gdt.data(), gdt_blocks_ * bs_);
+        }
+        tables_.flush();
+        blocks_.flush();
+        printf("blocks=%u block_size=%u groups=%u inodes_used=%llu\n", blocks_count_, bs_, groups_,
+               (unsigned long long)(inodes_count_ - free_inodes));
+    }
+
+    parameters p_;
+    uint32_t bs_;
+    image_writer tables_;
+    image_writer blocks_;
+    uint32_t dirs_;
+    uint32_t first_data_block_;
+    uint32_t bpg_;
+    uint32_t blocks_count_;
+    uint32_t groups_;
+    uint32_t gdt_blocks_;
+    uint32_t ipg_;
+    uint32_t inodes_count_;
+    uint32_t itable_blocks_;
+    uint32_t next_block_;
+    bool large_file_ = false;
+    std::vector<std::vector<uint8_t>> block_bitmaps_;
+    std::vector<std::vector<uint8_t>> inode_bitmaps_;
+    std::vector<uint32_t> free_blocks_;
+    std::vector<uint32_t> free_inodes_;
+    std::vector<uint32_t> used_dirs_;
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    parameters p;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:n:f:S:l:L:")) != -1) {
+        switch (opt) {
+            case 's': p.size = parse_size(optarg); break;
+            case 'b': p.block_size = strtoul(optarg, nullptr, 10); break;
+            case 'n': p.files = strtoul(optarg, nullptr, 10); break;
+            case 'f': p.fanout = strtoul(optarg, nullptr, 10); break;
+            case 'S': p.file_size = parse_size(optarg); break;
+            case 'l': p.large_files = strtoul(optarg, nullptr, 10); break;
+            case 'L': p.large_size = parse_size(optarg); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-s SIZE] [-b BLOCK_SIZE] [-n FILES] [-f FANOUT] [-S FILE_SIZE] "
+                        "[-l LARGE_FILES] [-L LARGE_SIZE] <out.img>\n", argv[0]);
+        return 1;
+    }
+    if (p.block_size != 1024 && p.block_size != 2048 && p.block_size != 4096) {
+        fail("block size must be 1024, 2048 or 4096");
+    }
+    if (p.fanout == 0) { fail("fanout must be at least 1"); }
+
+    int fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { fail(std::string("could not create ") + argv[optind] + ": " + strerror(errno)); }
+    // the image is sparse, only the metadata is ever written
+    if (ftruncate(fd, p.size / p.block_size * p.block_size) != 0) {
+        fail(std::string("could not size the image: ") + strerror(errno));
+    }
+    {
+        fs_builder builder(fd, p);
+        builder.build();
+    }
+    if (close(fd) != 0) { fail(std::string("write failed: ") + strerror(errno)); }
+    return 0;
+}
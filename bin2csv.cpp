@@ -0,0 +1,37 @@
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "binary_format.h"
+#include "image.h"
+
+// Converts the output of `p4exp1 --format=bin` back into the CSV that
+// `p4exp1` prints by default.
+// usage: ext2_bin2csv <file written with --format=bin>
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("usage: %s <binary dump>\n", argv[0]);
+        return 1;
+    }
+    // the dump is mapped (or read with std::fstream) just like an image
+    ext2_image dump;
+    if (!dump.open(argv[1])) {
+        printf("error: could not open %s\n", argv[1]);
+        return 1;
+    }
+    dump.advise(access_hint::sequential);
+    image_view data = dump.view(0, dump.size());
+    if (!data) {
+        printf("error: could not read %s\n", argv[1]);
+        return 1;
+    }
+    csv_writer out(STDOUT_FILENO);
+    bool ok = replay_bin(data.data(), data.size(), out);
+    out.flush();
+    if (output_error() != 0) {
+        fprintf(stderr, "error: could not write the output: %s\n", strerror(output_error()));
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
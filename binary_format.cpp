@@ -0,0 +1,466 @@
+#include "binary_format.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const char file_magic[8] = {'E', 'X', 'T', '2', 'C', 'O', 'L', '1'};
+const char chunk_magic[4] = {'C', 'H', 'N', 'K'};
+
+// column type: the width of an unsigned integer, or 0 for a byte heap
+const uint8_t HEAP = 0;
+
+struct column_def
+{
+    const char *name;
+    uint8_t type;
+};
+
+struct kind_def
+{
+    const char *name;
+    std::vector<column_def> columns;
+};
+
+const kind_def &schema(bin_kind kind)
+{
+    static const kind_def kinds[BIN_KIND_COUNT] = {
+        {"SUPERBLOCK", {{"blocks_count", 4}, {"inodes_count", 4}, {"block_size", 4}, {"inode_size", 2},
+                        {"blocks_per_group", 4}, {"inodes_per_group", 4}, {"first_ino", 4}}},
+        {"GROUP", {{"group", 4}, {"blocks", 4}, {"inodes", 4}, {"free_blocks", 2}, {"free_inodes", 2},
+                   {"block_bitmap", 4}, {"inode_bitmap", 4}, {"inode_table", 4}}},
+        {"BFREE", {{"block", 4}}},
+        {"IFREE", {{"inode", 4}}},
+        {"BFREE_RANGE", {{"first", 4}, {"count", 4}}},
+        {"IFREE_RANGE", {{"first", 4}, {"count", 4}}},
+        {"INODE", {{"inode", 4}, {"mode", 2}, {"uid", 2}, {"gid", 2}, {"links", 2},
+                   {"ctime", 4}, {"mtime", 4}, {"atime", 4}, {"size", 4}, {"blocks", 4},
+                   {"block0", 4}, {"block1", 4}, {"block2", 4}, {"block3", 4}, {"block4", 4},
+                   {"block5", 4}, {"block6", 4}, {"block7", 4}, {"block8", 4}, {"block9", 4},
+                   {"block10", 4}, {"block11", 4}, {"block12", 4}, {"block13", 4}, {"block14", 4}}},
+        {"DIRENT", {{"parent", 4}, {"offset", 4}, {"inode", 4}, {"rec_len", 2}, {"name_len", 1},
+                    {"name", HEAP}}},
+        {"INDIRECT", {{"inode", 4}, {"level", 1}, {"logical_offset", 4}, {"ind_block", 4}, {"block", 4}}},
+        {"MESSAGE", {{"length", 4}, {"text", HEAP}}},
+        {"EXTENT", {{"inode", 4}, {"logical_start", 4}, {"physical_start", 4}, {"length", 4}}},
+        {"META_EXTENT", {{"inode", 4}, {"physical_start", 4}, {"length", 4}}},
+    };
+    return kinds[kind];
+}
+
+template <typename T>
+void put(std::string &column, T value)
+{
+    column.append((const char *)&value, sizeof(T));
+}
+
+void pad8(std::string &out)
+{
+    out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+size_t padded8(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+std::string encode_header()
+{
+    std::string body;
+    put<uint32_t>(body, BIN_KIND_COUNT);
+    for (int kind = 0; kind < BIN_KIND_COUNT; kind++) {
+        const kind_def &def = schema((bin_kind)kind);
+        put<uint8_t>(body, kind);
+        put<uint8_t>(body, strlen(def.name));
+        body += def.name;
+        put<uint8_t>(body, def.columns.size());
+        for (const column_def &column : def.columns) {
+            put<uint8_t>(body, column.type);
+            put<uint8_t>(body, strlen(column.name));
+            body += column.name;
+        }
+    }
+    std::string header(file_magic, sizeof(file_magic));
+    put<uint32_t>(header, sizeof(file_magic) + sizeof(uint32_t) + body.size());
+    header += body;
+    pad8(header);
+    return header;
+}
+
+// Reads little endian integers out of a mapped file without running past its end
+struct bin_cursor
+{
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+
+    bool has(size_t len) const { return pos <= size && size - pos >= len; }
+    template <typename T>
+    T get()
+    {
+        T value;
+        memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+};
+
+} // namespace
+
+bin_writer::bin_writer(int fd)
+    : fd_(fd)
+{
+    for (int kind = 0; kind < BIN_KIND_COUNT; kind++) {
+        columns_[kind].resize(schema((bin_kind)kind).columns.size());
+    }
+}
+
+bin_writer::~bin_writer()
+{
+    flush();
+}
+
+std::vector<std::string> &bin_writer::row(bin_kind kind)
+{
+    // only ever flush between records
+    if (fd_ >= 0 && tags_.size() >= chunk_records) { flush(); }
+    tags_.push_back((char)kind);
+    rows_[kind]++;
+    return columns_[kind];
+}
+
+void bin_writer::clear()
+{
+    tags_.clear();
+    for (int kind = 0; kind < BIN_KIND_COUNT; kind++) {
+        rows_[kind] = 0;
+        for (std::string &column : columns_[kind]) { column.clear(); }
+    }
+}
+
+void bin_writer::superblock(const ext2_super_block &sb, uint32_t block_size)
+{
+    auto &c = row(BIN_SUPERBLOCK);
+    put<uint32_t>(c[0], sb.s_blocks_count);
+    put<uint32_t>(c[1], sb.s_inodes_count);
+    put<uint32_t>(c[2], block_size);
+    put<uint16_t>(c[3], sb.s_inode_size);
+    put<uint32_t>(c[4], sb.s_blocks_per_group);
+    put<uint32_t>(c[5], sb.s_inodes_per_group);
+    put<uint32_t>(c[6], sb.s_first_ino);
+}
+
+void bin_writer::group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+                       const ext2_group_desc &bgd)
+{
+    auto &c = row(BIN_GROUP);
+    put<uint32_t>(c[0], group);
+    put<uint32_t>(c[1], blocks_in_group);
+    put<uint32_t>(c[2], inodes_in_group);
+    put<uint16_t>(c[3], bgd.bg_free_blocks_count);
+    put<uint16_t>(c[4], bgd.bg_free_inodes_count);
+    put<uint32_t>(c[5], bgd.bg_block_bitmap);
+    put<uint32_t>(c[6], bgd.bg_inode_bitmap);
+    put<uint32_t>(c[7], bgd.bg_inode_table);
+}
+
+void bin_writer::bfree(uint32_t block)
+{
+    put<uint32_t>(row(BIN_BFREE)[0], block);
+}
+
+void bin_writer::ifree(uint32_t inode)
+{
+    put<uint32_t>(row(BIN_IFREE)[0], inode);
+}
+
+void bin_writer::bfree_range(uint32_t first, uint32_t count)
+{
+    auto &c = row(BIN_BFREE_RANGE);
+    put<uint32_t>(c[0], first);
+    put<uint32_t>(c[1], count);
+}
+
+void bin_writer::ifree_range(uint32_t first, uint32_t count)
+{
+    auto &c = row(BIN_IFREE_RANGE);
+    put<uint32_t>(c[0], first);
+    put<uint32_t>(c[1], count);
+}
+
+void bin_writer::inode(uint32_t inode_num, const ext2_inode &inode)
+{
+    auto &c = row(BIN_INODE);
+    put<uint32_t>(c[0], inode_num);
+    put<uint16_t>(c[1], inode.i_mode);
+    put<uint16_t>(c[2], inode.i_uid);
+    put<uint16_t>(c[3], inode.i_gid);
+    put<uint16_t>(c[4], inode.i_links_count);
+    put<uint32_t>(c[5], inode.i_ctime);
+    put<uint32_t>(c[6], inode.i_mtime);
+    put<uint32_t>(c[7], inode.i_atime);
+    put<uint32_t>(c[8], inode.i_size);
+    put<uint32_t>(c[9], inode.i_blocks);
+    for (int i = 0; i < EXT2_N_BLOCKS; i++) {
+        put<uint32_t>(c[10 + i], inode.i_block[i]);
+    }
+}
+
+void bin_writer::dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry)
+{
+    auto &c = row(BIN_DIRENT);
+    put<uint32_t>(c[0], parent);
+    put<uint32_t>(c[1], offset);
+    put<uint32_t>(c[2], entry.inode);
+    put<uint16_t>(c[3], entry.rec_len);
+    put<uint8_t>(c[4], entry.name_len);
+    c[5].append(entry.name, entry.name_len);
+}
+
+void bin_writer::indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                          uint32_t ind_block, uint32_t block)
+{
+    auto &c = row(BIN_INDIRECT);
+    put<uint32_t>(c[0], inode_num);
+    put<uint8_t>(c[1], level);
+    put<uint32_t>(c[2], logical_offset);
+    put<uint32_t>(c[3], ind_block);
+    put<uint32_t>(c[4], block);
+}
+
+void bin_writer::extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                        uint32_t length)
+{
+    auto &c = row(BIN_EXTENT);
+    put<uint32_t>(c[0], inode_num);
+    put<uint32_t>(c[1], logical_start);
+    put<uint32_t>(c[2], physical_start);
+    put<uint32_t>(c[3], length);
+}
+
+void bin_writer::meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length)
+{
+    auto &c = row(BIN_META_EXTENT);
+    put<uint32_t>(c[0], inode_num);
+    put<uint32_t>(c[1], physical_start);
+    put<uint32_t>(c[2], length);
+}
+
+void bin_writer::message(std::string_view line)
+{
+    auto &c = row(BIN_MESSAGE);
+    put<uint32_t>(c[0], line.size());
+    c[1].append(line.data(), line.size());
+}
+
+void bin_writer::append(record_writer &other)
+{
+    bin_writer &from = static_cast<bin_writer &>(other);
+    tags_ += from.tags_;
+    for (int kind = 0; kind < BIN_KIND_COUNT; kind++) {
+        rows_[kind] += from.rows_[kind];
+        for (size_t col = 0; col < columns_[kind].size(); col++) {
+            columns_[kind][col] += from.columns_[kind][col];
+        }
+    }
+    from.clear();
+    if (fd_ >= 0 && tags_.size() >= chunk_records) { flush(); }
+}
+
+void bin_writer::flush()
+{
+    if (fd_ < 0) { return; }
+    std::string out;
+    if (!header_written_) {
+        out = encode_header();
+        header_written_ = true;
+    }
+    out += take_chunk();
+    if (!write_all(fd_, out.data(), out.size())) { record_output_error(errno); }
+}
+
+std::string bin_writer::take_chunk()
+{
+    std::string out;
+    if (!tags_.empty()) {
+        std::string body;
+        put<uint32_t>(body, tags_.size());
+        put<uint32_t>(body, 0);
+        body += tags_;
+        pad8(body);
+        for (int kind = 0; kind < BIN_KIND_COUNT; kind++) {
+            put<uint32_t>(body, rows_[kind]);
+            put<uint32_t>(body, 0);
+            const kind_def &def = schema((bin_kind)kind);
+            for (size_t col = 0; col < def.columns.size(); col++) {
+                if (def.columns[col].type == HEAP) {
+                    put<uint64_t>(body, columns_[kind][col].size());
+                }
+                body += columns_[kind][col];
+                pad8(body);
+            }
+        }
+        out.append(chunk_magic, sizeof(chunk_magic));
+        put<uint32_t>(out, 0);
+        put<uint64_t>(out, body.size());
+        out += body;
+        clear();
+    }
+    return out;
+}
+
+bool replay_bin(const char *data, size_t size, record_writer &out)
+{
+    std::string header = encode_header();
+    if (size < header.size() || memcmp(data, header.data(), header.size()) != 0) {
+        std::cerr << "error: not a --format=bin file, or written with a different schema" << std::endl;
+        return false;
+    }
+    return replay_bin_chunks(data + header.size(), size - header.size(), out);
+}
+
+bool replay_bin_chunks(const char *data, size_t size, record_writer &out)
+{
+    bin_cursor file{data, size};
+    while (file.pos < size) {
+        if (!file.has(16) || memcmp(data + file.pos, chunk_magic, sizeof(chunk_magic)) != 0) {
+            std::cerr << "error: bad chunk at byte " << file.pos << std::endl;
+            return false;
+        }
+        file.pos += 8;
+        uint64_t chunk_size = file.get<uint64_t>();
+        if (!file.has(chunk_size)) {
+            std::cerr << "error: truncated chunk at byte " << file.pos << std::endl;
+            return false;
+        }
+        bin_cursor chunk{data + file.pos, (size_t)chunk_size};
+        file.pos += chunk_size;
+
+        if (!chunk.has(8)) { return false; }
+        uint32_t record_count = chunk.get<uint32_t>();
+        chunk.pos += 4;
+        if (!chunk.has(record_count)) { return false; }
+        const uint8_t *tags = (const uint8_t *)chunk.data + chunk.pos;
+        chunk.pos += padded8(record_count);
+
+        // locate every column of every kind
+        const char *columns[BIN_KIND_COUNT][EXT2_N_BLOCKS + 10] = {};
+        uint32_t rows[BIN_KIND_COUNT] = {};
+        uint64_t heap_bytes[BIN_KIND_COUNT] = {};
+        for (int kind = 0; kind < BIN_KIND_COUNT; kind++) {
+            if (!chunk.has(8)) { return false; }
+            rows[kind] = chunk.get<uint32_t>();
+            chunk.pos += 4;
+            const kind_def &def = schema((bin_kind)kind);
+            for (size_t col = 0; col < def.columns.size(); col++) {
+                uint64_t bytes = (uint64_t)rows[kind] * def.columns[col].type;
+                if (def.columns[col].type == HEAP) {
+                    if (!chunk.has(8)) { return false; }
+                    bytes = chunk.get<uint64_t>();
+                    heap_bytes[kind] = bytes;
+                }
+                if (!chunk.has(bytes)) {
+                    std::cerr << "error: truncated " << def.name << " column" << std::endl;
+                    return false;
+                }
+                columns[kind][col] = chunk.data + chunk.pos;
+                chunk.pos += padded8(bytes);
+            }
+        }
+
+        // walk the records in their original order
+        uint32_t next[BIN_KIND_COUNT] = {};
+        uint64_t heap_pos[BIN_KIND_COUNT] = {};
+        auto u8 = [&](int kind, int col, uint32_t r) { return (uint8_t)columns[kind][col][r]; };
+        auto u16 = [&](int kind, int col, uint32_t r) {
+            uint16_t v; memcpy(&v, columns[kind][col] + 2 * (size_t)r, 2); return v; };
+        auto u32 = [&](int kind, int col, uint32_t r) {
+            uint32_t v; memcpy(&v, columns[kind][col] + 4 * (size_t)r, 4); return v; };
+        for (uint32_t i = 0; i < record_count; i++) {
+            uint8_t kind = tags[i];
+            if (kind >= BIN_KIND_COUNT || next[kind] >= rows[kind]) {
+                std::cerr << "error: bad record tag" << std::endl;
+                return false;
+            }
+            uint32_t r = next[kind]++;
+            uint32_t heap_len = kind == BIN_DIRENT ? u8(kind, 4, r) : kind == BIN_MESSAGE ? u32(kind, 0, r) : 0;
+            if (heap_bytes[kind] - heap_pos[kind] < heap_len) {
+                std::cerr << "error: truncated heap column" << std::endl;
+                return false;
+            }
+            switch (kind) {
+                case BIN_SUPERBLOCK: {
+                    ext2_super_block sb = {};
+                    sb.s_blocks_count = u32(kind, 0, r);
+                    sb.s_inodes_count = u32(kind, 1, r);
+                    sb.s_inode_size = u16(kind, 3, r);
+                    sb.s_blocks_per_group = u32(kind, 4, r);
+                    sb.s_inodes_per_group = u32(kind, 5, r);
+                    sb.s_first_ino = u32(kind, 6, r);
+                    out.superblock(sb, u32(kind, 2, r));
+                    break;
+                }
+                case BIN_GROUP: {
+                    ext2_group_desc bgd = {};
+                    bgd.bg_free_blocks_count = u16(kind, 3, r);
+                    bgd.bg_free_inodes_count = u16(kind, 4, r);
+                    bgd.bg_block_bitmap = u32(kind, 5, r);
+                    bgd.bg_inode_bitmap = u32(kind, 6, r);
+                    bgd.bg_inode_table = u32(kind, 7, r);
+                    out.group(u32(kind, 0, r), u32(kind, 1, r), u32(kind, 2, r), bgd);
+                    break;
+                }
+                case BIN_BFREE: out.bfree(u32(kind, 0, r)); break;
+                case BIN_IFREE: out.ifree(u32(kind, 0, r)); break;
+                case BIN_BFREE_RANGE: out.bfree_range(u32(kind, 0, r), u32(kind, 1, r)); break;
+                case BIN_IFREE_RANGE: out.ifree_range(u32(kind, 0, r), u32(kind, 1, r)); break;
+                case BIN_INODE: {
+                    ext2_inode inode = {};
+                    inode.i_mode = u16(kind, 1, r);
+                    inode.i_uid = u16(kind, 2, r);
+                    inode.i_gid = u16(kind, 3, r);
+                    inode.i_links_count = u16(kind, 4, r);
+                    inode.i_ctime = u32(kind, 5, r);
+                    inode.i_mtime = u32(kind, 6, r);
+                    inode.i_atime = u32(kind, 7, r);
+                    inode.i_size = u32(kind, 8, r);
+                    inode.i_blocks = u32(kind, 9, r);
+                    for (int b = 0; b < EXT2_N_BLOCKS; b++) {
+                        inode.i_block[b] = u32(kind, 10 + b, r);
+                    }
+                    out.inode(u32(kind, 0, r), inode);
+                    break;
+                }
+                case BIN_DIRENT: {
+                    ext2_dir_entry entry;
+                    entry.inode = u32(kind, 2, r);
+                    entry.rec_len = u16(kind, 3, r);
+                    entry.name_len = u8(kind, 4, r);
+                    memcpy(entry.name, columns[kind][5] + heap_pos[kind], entry.name_len);
+                    heap_pos[kind] += entry.name_len;
+                    out.dirent(u32(kind, 0, r), u32(kind, 1, r), entry);
+                    break;
+                }
+                case BIN_INDIRECT:
+                    out.indirect(u32(kind, 0, r), u8(kind, 1, r), u32(kind, 2, r),
+                                 u32(kind, 3, r), u32(kind, 4, r));
+                    break;
+                case BIN_EXTENT:
+                    out.extent(u32(kind, 0, r), u32(kind, 1, r), u32(kind, 2, r), u32(kind, 3, r));
+                    break;
+                case BIN_META_EXTENT:
+                    out.meta_extent(u32(kind, 0, r), u32(kind, 1, r), u32(kind, 2, r));
+                    break;
+                case BIN_MESSAGE: {
+                    uint32_t length = u32(kind, 0, r);
+                    out.message(std::string_view(columns[kind][1] + heap_pos[kind], length));
+                    heap_pos[kind] += length;
+                    break;
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef EXT2_BINARY_FORMAT_H
+#define EXT2_BINARY_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "records.h"
+
+// Binary columnar encoding of the scan records (`--format=bin`).
+//
+// All integers are little endian. The file starts with a header that
+// describes the schema, followed by any number of chunks:
+//
+//   header: "EXT2COL1", u32 header size, u32 kind count, then for every kind
+//           u8 id, u8 name length, name, u8 column count and for every column
+//           u8 type (1, 2, 4 or 8 byte unsigned integer, 0 for a byte heap),
+//           u8 name length, name. Padded to a multiple of 8 bytes.
+//   chunk:  "CHNK", u32 0, u64 size of the rest of the chunk,
+//           u32 record count, u32 0, one u8 kind id per record in output
+//           order (padded to 8), then for every kind in schema order
+//           u32 row count, u32 0, and its columns one after another. A
+//           fixed width column is `rows` values, a heap column is a u64 byte
+//           count followed by the bytes. Every column is padded to 8 bytes, so
+//           a mapped file can be read as typed arrays in place.
+//
+// Variable length values live in heap columns: DIRENT names (sliced by the
+// name_len column) and MESSAGE text (sliced by the length column). INODE rows
+// store the raw mode and all 15 block pointers; which pointers are printed is
+// decided when the rows are converted back to CSV, exactly as the scan does.
+enum bin_kind : uint8_t
+{
+    BIN_SUPERBLOCK,
+    BIN_GROUP,
+    BIN_BFREE,
+    BIN_IFREE,
+    BIN_BFREE_RANGE,
+    BIN_IFREE_RANGE,
+    BIN_INODE,
+    BIN_DIRENT,
+    BIN_INDIRECT,
+    BIN_MESSAGE,
+    BIN_EXTENT,
+    BIN_META_EXTENT,
+    BIN_KIND_COUNT
+};
+
+class bin_writer : public record_writer
+{
+public:
+    // records are flushed to `fd` in chunks of about this many records
+    static constexpr uint32_t chunk_records = 1 << 16;
+
+    explicit bin_writer(int fd = -1);
+    ~bin_writer() override;
+
+    void superblock(const ext2_super_block &sb, uint32_t block_size) override;
+    void group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+               const ext2_group_desc &bgd) override;
+    void bfree(uint32_t block) override;
+    void ifree(uint32_t inode) override;
+    void bfree_range(uint32_t first, uint32_t count) override;
+    void ifree_range(uint32_t first, uint32_t count) override;
+    void inode(uint32_t inode_num, const ext2_inode &inode) override;
+    void dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry) override;
+    void indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                  uint32_t ind_block, uint32_t block) override;
+    void extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                uint32_t length) override;
+    void meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length) override;
+    void message(std::string_view line) override;
+
+    void append(record_writer &other) override;
+    void flush() override;
+
+    // Encodes the buffered records as one chunk (empty if there are none) and clears them
+    std::string take_chunk();
+
+private:
+    // Starts a record of `kind` and returns its columns
+    std::vector<std::string> &row(bin_kind kind);
+    void clear();
+
+    int fd_;
+    bool header_written_ = false;
+    std::string tags_;
+    uint32_t rows_[BIN_KIND_COUNT] = {};
+    // columns_[kind][column] holds the encoded values of one column
+    std::vector<std::string> columns_[BIN_KIND_COUNT];
+};
+
+// Replays the records of a `--format=bin` file into `out` in their original
+// order. Returns false (with a message on stderr) if the data is malformed.
+bool replay_bin(const char *data, size_t size, record_writer &out);
+// The same for a run of chunks without the file header, e.g. from `take_chunk`
+bool replay_bin_chunks(const char *data, size_t size, record_writer &out);
+
+#endif // EXT2_BINARY_FORMAT_H
@@ -0,0 +1,115 @@
+#ifndef EXT2_BITMAP_H
+#define EXT2_BITMAP_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Scanning kernels for the ext2 block and inode bitmaps.
+// Bit `i` of a bitmap is bit `i % 8` of byte `i / 8`, a set bit means "in use".
+// The bitmap is consumed a 64-bit word at a time (little endian, so bit `i`
+// of the bitmap is bit `i % 64` of its word). Runs of fully allocated words
+// are skipped with SIMD compares when the compiler targets SSE2/AVX2.
+
+// Loads the 64-bit word starting at bit `bit` (a multiple of 64). Bits at or
+// past `nbits` are returned as set so they are never reported as free.
+inline uint64_t bitmap_word(const char *bitmap, uint32_t nbits, uint32_t bit)
+{
+    uint32_t remaining = nbits - bit;
+    uint64_t word = ~(uint64_t)0;
+    if (remaining >= 64) {
+        memcpy(&word, bitmap + bit / 8, sizeof(word));
+        return word;
+    }
+    memcpy(&word, bitmap + bit / 8, (remaining + 7) / 8);
+    return word | (~(uint64_t)0 << remaining);
+}
+
+// Returns the first bit at or after `bit` (a multiple of 64) whose word is
+// not all ones, or `nbits` rounded down to a multiple of 64 when every full
+// word from `bit` on is fully allocated.
+inline uint32_t bitmap_skip_full(const char *bitmap, uint32_t nbits, uint32_t bit)
+{
+    uint32_t full_end = nbits & ~63u;
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    while (bit + 256 <= full_end) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(bitmap + bit / 8));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ones)) != 0xFFFFFFFFu) { break; }
+        bit += 256;
+    }
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi8((char)0xFF);
+    while (bit + 128 <= full_end) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bitmap + bit / 8));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ones)) != 0xFFFF) { break; }
+        bit += 128;
+    }
+#endif
+    while (bit < full_end && bitmap_word(bitmap, nbits, bit) == ~(uint64_t)0) { bit += 64; }
+    return bit;
+}
+
+// Calls `fn(i)` for every clear (free) bit `i` below `nbits`, in increasing order
+template <typename F>
+void for_each_free_bit(const char *bitmap, uint32_t nbits, F &&fn)
+{
+    for (uint32_t bit = 0; bit < nbits; bit += 64) {
+        bit = bitmap_skip_full(bitmap, nbits, bit);
+        if (bit >= nbits) { break; }
+        uint64_t free_bits = ~bitmap_word(bitmap, nbits, bit);
+        while (free_bits != 0) {
+            fn(bit + __builtin_ctzll(free_bits));
+            free_bits &= free_bits - 1;
+        }
+    }
+}
+
+// Calls `fn(first, count)` for every run of `count` consecutive free bits
+// starting at bit `first`, in increasing order
+template <typename F>
+void for_each_free_run(const char *bitmap, uint32_t nbits, F &&fn)
+{
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    for (uint32_t bit = 0; bit < nbits; bit += 64) {
+        uint32_t next = bitmap_skip_full(bitmap, nbits, bit);
+        if (next != bit && run_length != 0) {
+            fn(run_start, run_length);
+            run_length = 0;
+        }
+        bit = next;
+        if (bit >= nbits) { break; }
+        uint64_t free_bits = ~bitmap_word(bitmap, nbits, bit);
+        if (free_bits == ~(uint64_t)0 && bit + 64 <= nbits) {
+            // the whole word is free, extend (or start) the current run
+            if (run_length == 0) { run_start = bit; }
+            run_length += 64;
+            continue;
+        }
+        uint32_t pos = 0;
+        while (pos < 64) {
+            uint64_t rest = free_bits >> pos;
+            if (rest == 0) {
+                if (run_length != 0) { fn(run_start, run_length); run_length = 0; }
+                break;
+            }
+            uint32_t zeros = __builtin_ctzll(rest); // allocated bits before the next free one
+            if (zeros != 0) {
+                if (run_length != 0) { fn(run_start, run_length); run_length = 0; }
+                pos += zeros;
+                continue;
+            }
+            uint32_t ones = ~rest == 0 ? 64 - pos : __builtin_ctzll(~rest); // free bits in this stretch
+            if (run_length == 0) { run_start = bit + pos; }
+            run_length += ones;
+            pos += ones;
+        }
+    }
+    if (run_length != 0) { fn(run_start, run_length); }
+}
+
+#endif // EXT2_BITMAP_H
@@ -0,0 +1,29 @@
+#include "block_cache.h"
+
+block_cache::block_cache(ext2_image &image, uint32_t block_size, size_t budget)
+    : image_(image), block_size_(block_size)
+{
+    // always keep at least one block per level of the deepest (triple) indirect walk
+    max_blocks_ = budget / block_size;
+    if (max_blocks_ < 4) { max_blocks_ = 4; }
+}
+
+cached_block block_cache::get(uint32_t block)
+{
+    auto found = index_.find(block);
+    if (found != index_.end()) {
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, found->second);
+        return found->second->data;
+    }
+    misses_++;
+    auto data = std::make_shared<image_view>(image_.view((uint64_t)block * block_size_, block_size_));
+    if (!*data) { return {}; }
+    if (lru_.size() >= max_blocks_) {
+        index_.erase(lru_.back().block);
+        lru_.pop_back();
+    }
+    lru_.push_front(entry{block, data});
+    index_[block] = lru_.begin();
+    return data;
+}
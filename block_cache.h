@@ -0,0 +1,51 @@
+#ifndef EXT2_BLOCK_CACHE_H
+#define EXT2_BLOCK_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "image.h"
+
+// A whole block of the image. Holders keep the block alive even after the
+// cache has evicted it.
+using cached_block = std::shared_ptr<const image_view>;
+
+// LRU cache of whole image blocks, used for indirect and directory blocks.
+// Each block is read once with a single `block_size` read and every pointer
+// and directory entry lookup after that is served from memory.
+// When the image is memory mapped the cached views point into the mapping,
+// so the cache only saves the bounds checks and keeps the hit/miss counts.
+class block_cache
+{
+public:
+    // `budget` is the most memory (in bytes) the cached blocks may use
+    block_cache(ext2_image &image, uint32_t block_size, size_t budget);
+
+    // Returns the block, or an empty pointer if it lies outside the image
+    cached_block get(uint32_t block);
+
+    uint32_t block_size() const { return block_size_; }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    struct entry
+    {
+        uint32_t block;
+        cached_block data;
+    };
+
+    ext2_image &image_;
+    uint32_t block_size_;
+    size_t max_blocks_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    // most recently used block at the front
+    std::list<entry> lru_;
+    std::unordered_map<uint32_t, std::list<entry>::iterator> index_;
+};
+
+#endif // EXT2_BLOCK_CACHE_H
@@ -0,0 +1,571 @@
+#include "diff.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "bitmap.h"
+#include "filesystem.h"
+#include "hash.h"
+#include "output.h"
+#include "thread_pool.h"
+
+namespace {
+
+// One of the two images
+struct snapshot
+{
+    ext2_image image;
+    ext2_layout layout;
+
+    bool open(const char *path, bool use_mmap, bool direct)
+    {
+        if (!image.open(path, use_mmap, direct)) {
+            std::cerr << "Could not open file " << path << std::endl;
+            return false;
+        }
+        image.advise(access_hint::random);
+        if (!read_superblock(image, layout) || !read_group_descriptors(image, layout)) {
+            std::cerr << "error: could not read the superblock and group descriptors of " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+enum class change_kind
+{
+    added,
+    removed,
+    changed,
+};
+
+const char *change_name(change_kind kind)
+{
+    switch (kind) {
+    case change_kind::added: return "added";
+    case change_kind::removed: return "removed";
+    default: return "changed";
+    }
+}
+
+struct inode_change
+{
+    uint32_t inode_num;
+    change_kind kind;
+};
+
+// An inode the scan would print
+bool in_use(const ext2_inode &inode)
+{
+    return inode.i_mode != 0 && inode.i_links_count != 0;
+}
+
+// Inodes whose block map the scan walks
+bool has_block_map(const ext2_inode &inode)
+{
+    char file_type = inode_file_type(inode);
+    return file_type == 'd' || file_type == 'f';
+}
+
+// Calls `data(logical, block)` for every data block of `inode` and
+// `meta(logical, block)` for every indirect block, `logical` being the first
+// data block below it (as in the INDIRECT records)
+template <typename Data, typename Meta>
+bool walk_block_map(const ext2_inode &inode, block_cache &cache, record_writer &out, Data &&data, Meta &&meta)
+{
+    uint32_t per_block = cache.block_size() / sizeof(__u32);
+    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+        if (inode.i_block[i] != 0) { data(i, inode.i_block[i]); }
+    }
+    return for_each_indirect_pointer(inode, cache, out,
+        [&](int level, uint32_t block) { meta(indirect_tree_start(per_block, level), block); },
+        [&](int level, uint32_t logical, uint32_t, uint32_t block) {
+            if (level == 1) {
+                data(logical, block);
+            } else {
+                meta(logical, block);
+            }
+        });
+}
+
+// What one block group contributes to the diff
+struct group_diff
+{
+    // the descriptor or a bitmap differs, so the group's allocated blocks were checksummed
+    bool hashed = false;
+    // inodes of the group that were added, removed or changed, in order
+    std::vector<inode_change> inodes;
+    // unchanged directory inodes whose blocks differ, e.g. after an entry was
+    // removed without the kernel updating the directory, in order
+    std::vector<uint32_t> directories;
+    // allocated blocks that are new or whose checksum differs
+    std::vector<uint32_t> changed_blocks;
+    // the DIFF_INODE, DIFF_DIRENT and DIFF_BLOCK lines of `inodes`, then the
+    // DIFF_BLOCK lines of unchanged inodes that own a changed block
+    std::unique_ptr<output_sink> lines;
+    std::unique_ptr<output_sink> owner_lines;
+    // changed blocks the lines account for
+    std::vector<uint32_t> owned_blocks;
+    // read errors
+    csv_writer messages;
+};
+
+class image_diff
+{
+public:
+    image_diff(snapshot &old_snap, snapshot &new_snap, size_t cache_bytes, unsigned jobs);
+
+    // Prints the differences to `out`. Returns the `diff_images` status.
+    int run(output_sink &out);
+
+private:
+    // per worker state
+    struct worker_state
+    {
+        std::unique_ptr<block_cache> old_cache;
+        std::unique_ptr<block_cache> new_cache;
+        std::vector<char> old_scratch;
+        std::vector<char> new_scratch;
+    };
+
+    // Runs `task(group, worker)` for every group in `groups` on the pool
+    template <typename Task>
+    void for_each_group(const std::vector<int> &groups, Task task)
+    {
+        for (int group : groups) {
+            pool_.submit([&, group](unsigned worker) { task(group, worker); });
+        }
+        pool_.wait();
+    }
+
+    void compare_group(int group, unsigned worker);
+    // Whether a block of the directory `inode_num`, which is the same inode in
+    // both images, differs
+    bool directory_differs(uint32_t inode_num, unsigned worker, group_diff &result);
+    void describe_group(int group, unsigned worker);
+    void find_owners(int group, unsigned worker);
+    void diff_entries(uint32_t inode_num, const ext2_inode *old_dir, const ext2_inode &new_dir,
+                      unsigned worker, group_diff &result);
+    void diff_blocks(uint32_t inode_num, const ext2_inode *old_inode, const ext2_inode &new_inode,
+                     bool contents_may_differ, unsigned worker, group_diff &result);
+    // Whether the contents of `old_block` in OLD and `new_block` in NEW differ
+    // (or can't be read)
+    bool blocks_differ(uint32_t old_block, uint32_t new_block, unsigned worker);
+    int group_of(uint32_t block) const;
+    bool is_metadata(uint32_t block) const;
+    output_sink &lines(std::unique_ptr<output_sink> &sink);
+
+    snapshot &old_;
+    snapshot &new_;
+    const ext2_super_block &sb_;
+    uint32_t block_size_;
+    thread_pool pool_;
+    std::vector<worker_state> workers_;
+    std::vector<group_diff> groups_;
+    // the changed blocks of every group, and those no inode has claimed yet
+    std::unordered_set<uint32_t> changed_blocks_;
+    std::unordered_set<uint32_t> unclaimed_;
+    // superblock backups, descriptor tables, bitmaps and inode tables as
+    // (first block, block count), sorted
+    std::vector<std::pair<uint32_t, uint32_t>> metadata_;
+};
+
+image_diff::image_diff(snapshot &old_snap, snapshot &new_snap, size_t cache_bytes, unsigned jobs)
+    : old_(old_snap), new_(new_snap), sb_(*new_snap.layout.sb), block_size_(new_snap.layout.block_size),
+      pool_(jobs), workers_(pool_.size()), groups_(new_snap.layout.group_count)
+{
+    // both images' indirect and directory blocks are cached
+    size_t budget = cache_bytes / (2 * workers_.size());
+    for (worker_state &worker : workers_) {
+        worker.old_cache = std::make_unique<block_cache>(old_.image, block_size_, budget);
+        worker.new_cache = std::make_unique<block_cache>(new_.image, block_size_, budget);
+    }
+    const ext2_layout &layout = new_.layout;
+    uint32_t gdt_blocks = ((uint64_t)layout.group_count * sizeof(ext2_group_desc) + block_size_ - 1) / block_size_;
+    uint32_t inode_table_blocks = ((uint64_t)sb_.s_inodes_per_group * inode_size(sb_) + block_size_ - 1) / block_size_;
+    for (int group = 0; group < layout.group_count; group++) {
+        if (has_superblock(sb_, group)) { metadata_.push_back({group_first_block(sb_, group), gdt_blocks + 1}); }
+        const ext2_group_desc &bgd = layout.group_desc(group);
+        metadata_.push_back({bgd.bg_block_bitmap, 1});
+        metadata_.push_back({bgd.bg_inode_bitmap, 1});
+        metadata_.push_back({bgd.bg_inode_table, inode_table_blocks});
+    }
+    std::sort(metadata_.begin(), metadata_.end());
+}
+
+int image_diff::group_of(uint32_t block) const
+{
+    if (block < sb_.s_first_data_block) { return -1; }
+    return (block - sb_.s_first_data_block) / sb_.s_blocks_per_group;
+}
+
+bool image_diff::is_metadata(uint32_t block) const
+{
+    auto after = std::upper_bound(metadata_.begin(), metadata_.end(), std::make_pair(block, UINT32_MAX));
+    // the ranges don't overlap, so only the last one starting at or before `block` can hold it
+    return after != metadata_.begin() && block - std::prev(after)->first < std::prev(after)->second;
+}
+
+output_sink &image_diff::lines(std::unique_ptr<output_sink> &sink)
+{
+    if (!sink) { sink = std::make_unique<output_sink>(-1, 4096); }
+    return *sink;
+}
+
+bool image_diff::blocks_differ(uint32_t old_block, uint32_t new_block, unsigned worker)
+{
+    worker_state &state = workers_[worker];
+    image_view a = old_.image.view((uint64_t)old_block * block_size_, block_size_, state.old_scratch);
+    image_view b = new_.image.view((uint64_t)new_block * block_size_, block_size_, state.new_scratch);
+    if (!a || !b) { return true; }
+    uint32_t crc[2] = {0, 0};
+    crc32c_pair(a.data(), b.data(), block_size_, crc);
+    return crc[0] != crc[1];
+}
+
+bool image_diff::directory_differs(uint32_t inode_num, unsigned worker, group_diff &result)
+{
+    ext2_inode dir;
+    if (!read_inode(new_.image, new_.layout, inode_num, dir)) { return true; }
+    bool differs = false;
+    auto compare = [&](uint32_t, uint32_t block) {
+        if (!differs) { differs = blocks_differ(block, block, worker); }
+    };
+    walk_block_map(dir, *workers_[worker].new_cache, result.messages, compare, compare);
+    return differs;
+}
+
+// Compares the group's descriptor, bitmaps, inode table and the blocks of its
+// unchanged directories, and checksums its allocated blocks if the descriptor
+// or a bitmap differs
+void image_diff::compare_group(int group, unsigned worker)
+{
+    group_diff &result = groups_[group];
+    worker_state &state = workers_[worker];
+    const ext2_group_desc &old_bgd = old_.layout.group_desc(group);
+    const ext2_group_desc &new_bgd = new_.layout.group_desc(group);
+    uint32_t blocks_in_group = group_block_count(sb_, group);
+    uint32_t inodes_in_group = group_inode_count(sb_, group);
+    uint32_t first_block = group_first_block(sb_, group);
+    uint32_t first_inode = sb_.s_inodes_per_group * group;
+
+    image_view old_block_bitmap = old_.image.view((uint64_t)old_bgd.bg_block_bitmap * block_size_,
+                                                  (blocks_in_group + 7) / 8);
+    image_view new_block_bitmap = new_.image.view((uint64_t)new_bgd.bg_block_bitmap * block_size_,
+                                                  (blocks_in_group + 7) / 8);
+    image_view old_inode_bitmap = old_.image.view((uint64_t)old_bgd.bg_inode_bitmap * block_size_,
+                                                  (inodes_in_group + 7) / 8);
+    image_view new_inode_bitmap = new_.image.view((uint64_t)new_bgd.bg_inode_bitmap * block_size_,
+                                                  (inodes_in_group + 7) / 8);
+    if (!old_block_bitmap || !new_block_bitmap || !old_inode_bitmap || !new_inode_bitmap) {
+        result.messages.message("error: could not read the bitmaps of group " + std::to_string(group) + "\n");
+        return;
+    }
+    result.hashed = memcmp(&old_bgd, &new_bgd, sizeof(ext2_group_desc)) != 0 ||
+                    memcmp(old_block_bitmap.data(), new_block_bitmap.data(), old_block_bitmap.size()) != 0 ||
+                    memcmp(old_inode_bitmap.data(), new_inode_bitmap.data(), old_inode_bitmap.size()) != 0;
+
+    // the inode tables, a whole table at a time
+    uint32_t stride = inode_size(sb_);
+    uint64_t table_bytes = (uint64_t)inodes_in_group * stride;
+    image_view old_table = old_.image.view((uint64_t)old_bgd.bg_inode_table * block_size_, table_bytes,
+                                           state.old_scratch);
+    image_view new_table = new_.image.view((uint64_t)new_bgd.bg_inode_table * block_size_, table_bytes,
+                                           state.new_scratch);
+    if (!old_table || !new_table) {
+        result.messages.message("error: could not read the inode table of group " + std::to_string(group) + "\n");
+        return;
+    }
+    bool tables_differ = memcmp(old_table.data(), new_table.data(), table_bytes) != 0;
+    // directories whose entries can change without their inode (or the
+    // group's bitmaps) changing, compared once the tables are no longer needed
+    std::vector<uint32_t> directories;
+    for (uint32_t i = 0; i < inodes_in_group; i++) {
+        uint32_t inode_num = first_inode + i + 1;
+        const ext2_inode &old_inode = *old_table.at<ext2_inode>((uint64_t)i * stride);
+        const ext2_inode &new_inode = *new_table.at<ext2_inode>((uint64_t)i * stride);
+        if (!tables_differ || memcmp(&old_inode, &new_inode, stride) == 0) {
+            if (in_use(new_inode) && inode_file_type(new_inode) == 'd') { directories.push_back(inode_num); }
+            continue;
+        }
+        bool was_used = in_use(old_inode);
+        bool is_used = in_use(new_inode);
+        if (was_used || is_used) {
+            change_kind kind = !was_used ? change_kind::added : !is_used ? change_kind::removed :
+                               change_kind::changed;
+            result.inodes.push_back({inode_num, kind});
+        }
+    }
+    // the tables were read into the scratch buffers `blocks_differ` reuses
+    for (uint32_t inode_num : directories) {
+        if (directory_differs(inode_num, worker, result)) { result.directories.push_back(inode_num); }
+    }
+    if (!result.hashed) { return; }
+
+    // every block allocated in NEW that wasn't in OLD, or whose contents differ
+    const char *old_bits = old_block_bitmap.data();
+    const char *new_bits = new_block_bitmap.data();
+    for (uint32_t bit = 0; bit < blocks_in_group; bit += 64) {
+        uint64_t used = bitmap_word(new_bits, blocks_in_group, bit);
+        uint64_t was_used = bitmap_word(old_bits, blocks_in_group, bit);
+        // bits past the end of the group read as set
+        if (blocks_in_group - bit < 64) { used &= ~(~(uint64_t)0 << (blocks_in_group - bit)); }
+        for (; used != 0; used &= used - 1) {
+            uint32_t i = __builtin_ctzll(used);
+            uint32_t block = first_block + bit + i;
+            if (block >= sb_.s_blocks_count) { break; }
+            if (!((was_used >> i) & 1) || blocks_differ(block, block, worker)) {
+                result.changed_blocks.push_back(block);
+            }
+        }
+    }
+}
+
+// Prints the changes of a directory's entries: names that appeared, went away
+// or now refer to another inode. `old_dir` is null if there was no directory.
+void image_diff::diff_entries(uint32_t inode_num, const ext2_inode *old_dir, const ext2_inode &new_dir,
+                              unsigned worker, group_diff &result)
+{
+    using entry_list = std::vector<std::pair<std::string, uint32_t>>;
+    auto read_entries = [&](const ext2_inode &dir, block_cache &cache, entry_list &entries) {
+        for_each_dir_entry(dir, cache, result.messages, [&](uint64_t, const ext2_dir_entry &entry) {
+            entries.emplace_back(std::string(entry.name, entry.name_len), entry.inode);
+        });
+    };
+    entry_list old_entries, new_entries;
+    if (old_dir != nullptr) { read_entries(*old_dir, *workers_[worker].old_cache, old_entries); }
+    read_entries(new_dir, *workers_[worker].new_cache, new_entries);
+    std::unordered_map<std::string, uint32_t> old_names(old_entries.begin(), old_entries.end());
+    std::unordered_map<std::string, uint32_t> new_names(new_entries.begin(), new_entries.end());
+
+    output_sink &out = lines(result.lines);
+    auto print = [&](const char *kind, const std::string &name, uint32_t inode) {
+        out << "DIFF_DIRENT," << inode_num << "," << kind << "," << inode << ",'" << name << "'\n";
+    };
+    for (const auto &entry : new_entries) {
+        auto old_entry = old_names.find(entry.first);
+        if (old_entry == old_names.end()) {
+            print("added", entry.first, entry.second);
+        } else if (old_entry->second != entry.second) {
+            print("changed", entry.first, entry.second);
+        }
+    }
+    for (const auto &entry : old_entries) {
+        if (new_names.find(entry.first) == new_names.end()) { print("removed", entry.first, entry.second); }
+    }
+}
+
+// Prints the changed blocks of an added or changed inode. Blocks in the
+// checksummed groups are looked up in `changed_blocks_`, the others are
+// compared with the block the inode had at the same logical position in OLD,
+// unless `contents_may_differ` says the inode's data wasn't touched.
+// `old_inode` is null if there was no file or directory.
+void image_diff::diff_blocks(uint32_t inode_num, const ext2_inode *old_inode, const ext2_inode &new_inode,
+                             bool contents_may_differ, unsigned worker, group_diff &result)
+{
+    // (logical, physical) pairs of the old data blocks, in logical order
+    std::vector<std::pair<uint32_t, uint32_t>> old_map;
+    if (old_inode != nullptr && contents_may_differ) {
+        walk_block_map(*old_inode, *workers_[worker].old_cache, result.messages,
+            [&](uint32_t logical, uint32_t block) { old_map.push_back({logical, block}); },
+            [](uint32_t, uint32_t) {});
+    }
+    output_sink &out = lines(result.lines);
+    auto print = [&](uint32_t block, const char *kind, uint32_t logical) {
+        out << "DIFF_BLOCK," << block << "," << kind << "," << inode_num << "," << logical << "\n";
+        result.owned_blocks.push_back(block);
+    };
+    size_t at = 0;
+    walk_block_map(new_inode, *workers_[worker].new_cache, result.messages,
+        [&](uint32_t logical, uint32_t block) {
+            if (changed_blocks_.count(block) != 0) {
+                print(block, "data", logical);
+                return;
+            }
+            if (!contents_may_differ) { return; }
+            while (at < old_map.size() && old_map[at].first < logical) { at++; }
+            uint32_t old_block = at < old_map.size() && old_map[at].first == logical ? old_map[at].second : 0;
+            int group = group_of(block);
+            // a block of a checksummed group that isn't in `changed_blocks_` is unchanged
+            if (old_block == block && group >= 0 && group < (int)groups_.size() && groups_[group].hashed) {
+                return;
+            }
+            if (old_block == 0 || blocks_differ(old_block, block, worker)) {
+                out << "DIFF_BLOCK," << block << ",data," << inode_num << "," << logical << "\n";
+            }
+        },
+        [&](uint32_t logical, uint32_t block) {
+            if (changed_blocks_.count(block) != 0) { print(block, "indirect", logical); }
+        });
+}
+
+// Prints the changes of every inode of the group that was added, removed or
+// changed, and of the directories whose blocks changed under an unchanged inode
+void image_diff::describe_group(int group, unsigned worker)
+{
+    group_diff &result = groups_[group];
+    for (const inode_change &change : result.inodes) {
+        ext2_inode old_inode, new_inode;
+        if (!read_inode(old_.image, old_.layout, change.inode_num, old_inode) ||
+            !read_inode(new_.image, new_.layout, change.inode_num, new_inode)) {
+            result.messages.message("error: could not read inode " + std::to_string(change.inode_num) + "\n");
+            continue;
+        }
+        const ext2_inode &current = change.kind == change_kind::removed ? old_inode : new_inode;
+        lines(result.lines) << "DIFF_INODE," << change.inode_num << "," << change_name(change.kind) << ","
+                            << inode_file_type(current) << "\n";
+        if (change.kind == change_kind::removed) { continue; }
+        bool had_map = change.kind == change_kind::changed && has_block_map(old_inode) &&
+                       inode_file_type(old_inode) == inode_file_type(new_inode);
+        // Writing to a file updates its modification time, so a file whose
+        // time, size and block pointers are the same (e.g. after a chmod) still
+        // has the same contents. Directories are small and not every tool
+        // updates their time, so their entries are always compared.
+        bool contents_may_differ = !had_map || old_inode.i_mtime != new_inode.i_mtime ||
+                                   old_inode.i_size != new_inode.i_size ||
+                                   memcmp(old_inode.i_block, new_inode.i_block, sizeof(old_inode.i_block)) != 0;
+        if (inode_file_type(new_inode) == 'd') {
+            diff_entries(change.inode_num, had_map ? &old_inode : nullptr, new_inode, worker, result);
+        }
+        if (has_block_map(new_inode)) {
+            diff_blocks(change.inode_num, had_map ? &old_inode : nullptr, new_inode, contents_may_differ,
+                        worker, result);
+        }
+    }
+    for (uint32_t inode_num : result.directories) {
+        ext2_inode dir;
+        if (!read_inode(new_.image, new_.layout, inode_num, dir)) {
+            result.messages.message("error: could not read inode " + std::to_string(inode_num) + "\n");
+            continue;
+        }
+        diff_entries(inode_num, &dir, dir, worker, result);
+        diff_blocks(inode_num, &dir, dir, true, worker, result);
+    }
+}
+
+// Looks for the owners of `unclaimed_` blocks among the group's inodes that
+// didn't change, e.g. files written to without the kernel updating them
+void image_diff::find_owners(int group, unsigned worker)
+{
+    group_diff &result = groups_[group];
+    worker_state &state = workers_[worker];
+    const ext2_group_desc &bgd = new_.layout.group_desc(group);
+    uint32_t inodes_in_group = group_inode_count(sb_, group);
+    uint32_t first_inode = sb_.s_inodes_per_group * group;
+    uint32_t stride = inode_size(sb_);
+    image_view table = new_.image.view((uint64_t)bgd.bg_inode_table * block_size_,
+                                       (uint64_t)inodes_in_group * stride, state.new_scratch);
+    if (!table) { return; }
+    size_t next_change = 0;
+    for (uint32_t i = 0; i < inodes_in_group; i++) {
+        uint32_t inode_num = first_inode + i + 1;
+        while (next_change < result.inodes.size() && result.inodes[next_change].inode_num < inode_num) {
+            next_change++;
+        }
+        // changed inodes were walked by `describe_group`
+        if (next_change < result.inodes.size() && result.inodes[next_change].inode_num == inode_num) { continue; }
+        const ext2_inode &inode = *table.at<ext2_inode>((uint64_t)i * stride);
+        if (!in_use(inode) || !has_block_map(inode)) { continue; }
+        auto claim = [&](const char *kind, uint32_t logical, uint32_t block) {
+            if (unclaimed_.count(block) == 0) { return; }
+            lines(result.owner_lines) << "DIFF_BLOCK," << block << "," << kind << "," << inode_num << ","
+                                      << logical << "\n";
+            result.owned_blocks.push_back(block);
+        };
+        walk_block_map(inode, *state.new_cache, result.messages,
+            [&](uint32_t logical, uint32_t block) { claim("data", logical, block); },
+            [&](uint32_t logical, uint32_t block) { claim("indirect", logical, block); });
+    }
+}
+
+int image_diff::run(output_sink &out)
+{
+    std::vector<int> all_groups(groups_.size());
+    for (size_t g = 0; g < groups_.size(); g++) { all_groups[g] = g; }
+    for_each_group(all_groups, [this](int group, unsigned worker) { compare_group(group, worker); });
+
+    std::vector<int> changed_groups;
+    for (size_t g = 0; g < groups_.size(); g++) {
+        changed_blocks_.insert(groups_[g].changed_blocks.begin(), groups_[g].changed_blocks.end());
+        if (!groups_[g].inodes.empty() || !groups_[g].directories.empty()) { changed_groups.push_back(g); }
+    }
+    for_each_group(changed_groups, [this](int group, unsigned worker) { describe_group(group, worker); });
+
+    // changed blocks that are neither the filesystem's own metadata nor in the
+    // block map of an inode that changed
+    unclaimed_ = changed_blocks_;
+    for (const group_diff &result : groups_) {
+        for (uint32_t block : result.owned_blocks) { unclaimed_.erase(block); }
+    }
+    for (auto block = unclaimed_.begin(); block != unclaimed_.end();) {
+        block = is_metadata(*block) ? unclaimed_.erase(block) : std::next(block);
+    }
+    if (!unclaimed_.empty()) {
+        for_each_group(all_groups, [this](int group, unsigned worker) { find_owners(group, worker); });
+    }
+
+    bool differ = false;
+    bool ok = true;
+    for (group_diff &result : groups_) {
+        if (result.lines) {
+            out << result.lines->text();
+            differ = true;
+        }
+    }
+    std::vector<uint32_t> others;
+    for (group_diff &result : groups_) {
+        if (result.owner_lines) {
+            out << result.owner_lines->text();
+            differ = true;
+        }
+        for (uint32_t block : result.owned_blocks) { unclaimed_.erase(block); }
+    }
+    // the metadata blocks and the blocks no inode claims, in block order
+    for (const group_diff &result : groups_) {
+        for (uint32_t block : result.changed_blocks) {
+            if (is_metadata(block) || unclaimed_.count(block) != 0) { others.push_back(block); }
+        }
+    }
+    for (uint32_t block : others) {
+        out << "DIFF_BLOCK," << block << "," << (is_metadata(block) ? "metadata" : "unowned") << ",0,0\n";
+        differ = true;
+    }
+    out.flush();
+    for (group_diff &result : groups_) {
+        std::string_view errors = result.messages.sink().text();
+        if (!errors.empty()) {
+            std::cerr << errors;
+            ok = false;
+        }
+    }
+    return !ok ? 1 : differ ? 2 : 0;
+}
+
+} // namespace
+
+int diff_images(const char *old_file, const char *new_file, bool use_mmap, bool direct, size_t cache_bytes,
+                unsigned jobs)
+{
+    snapshot old_snap, new_snap;
+    if (!old_snap.open(old_file, use_mmap, direct) || !new_snap.open(new_file, use_mmap, direct)) { return 1; }
+    const ext2_super_block &a = *old_snap.layout.sb;
+    const ext2_super_block &b = *new_snap.layout.sb;
+    if (a.s_blocks_count != b.s_blocks_count || a.s_inodes_count != b.s_inodes_count ||
+        a.s_log_block_size != b.s_log_block_size || a.s_first_data_block != b.s_first_data_block ||
+        a.s_blocks_per_group != b.s_blocks_per_group || a.s_inodes_per_group != b.s_inodes_per_group ||
+        inode_size(a) != inode_size(b)) {
+        std::cerr << "error: " << new_file << " is not a snapshot of the same filesystem as " << old_file
+                  << std::endl;
+        return 1;
+    }
+    output_sink out(STDOUT_FILENO);
+    image_diff diff(old_snap, new_snap, cache_bytes, jobs);
+    return diff.run(out);
+}
@@ -0,0 +1,26 @@
+#ifndef EXT2_DIFF_H
+#define EXT2_DIFF_H
+
+#include <cstddef>
+
+// Reports what changed between two snapshots of the same filesystem
+// (`--diff OLD NEW`) without dumping either of them.
+// The descriptor, both bitmaps and the inode table of every block group are
+// compared first, and so are the blocks of the directories whose inode didn't
+// change, as entries can come and go without it changing. In the groups whose
+// descriptor or bitmaps differ, each block allocated in NEW is checksummed
+// (CRC-32C) in both images. Then only the inodes that were added, removed or
+// changed and those directories are walked: directories have their entries
+// compared, and every block of a changed file is matched against the blocks
+// found above or, when its group wasn't checksummed, compared with the block
+// at the same logical position in OLD. Each changed block is reported with
+// its owning inode and logical block, so the cost follows the amount of
+// changed data and the size of the directories rather than the size of the
+// images.
+// The groups are handled on `jobs` threads. Prints the DIFF_* lines described
+// in the README to stdout and returns 1 (with a message on stderr) on failure,
+// 2 if the images differ and 0 if they don't.
+int diff_images(const char *old_file, const char *new_file, bool use_mmap, bool direct, size_t cache_bytes,
+                unsigned jobs);
+
+#endif // EXT2_DIFF_H
@@ -17,6 +17,9 @@
  *  Simplified for OS project use by Mark Kampe
  */
 
+#ifndef _EXT2_FS_H
+#define _EXT2_FS_H
+
 /* types normally from linux/types.h	*/
 typedef __uint32_t	__u32;
 typedef __uint16_t	__u16;
@@ -44,6 +47,12 @@ typedef __int16_t	__s16;
  */
 #define EXT2_SUPER_MAGIC	0xEF53
 
+/*
+ * Feature set definitions
+ */
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
+
 /*
  * Macro-instructions used to manage several block sizes
  */
@@ -106,6 +115,11 @@ struct ext2_inode {
 	__u32	i_reserved2[2];
 };
 
+/*
+ * Inode flags
+ */
+#define EXT2_INDEX_FL			0x00001000 /* hash-indexed directory */
+
 #define EXT2_I_IFLNK  	  0xA000
 #define EXT2_I_IFREG  	  0x8000
 #define EXT2_I_IFDIR  	  0x4000
@@ -117,6 +131,12 @@ struct ext2_inode {
 #define	EXT2_VALID_FS			0x0001	/* Unmounted cleanly */
 #define	EXT2_ERROR_FS			0x0002	/* Errors detected */
 
+/*
+ * Misc. filesystem flags
+ */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001  /* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002  /* Unsigned dirhash in use */
+
 /*
  * Structure of the super block
  */
@@ -168,7 +188,26 @@ struct ext2_super_block {
 	__u32	s_feature_compat; 	/* compatible feature set */
 	__u32	s_feature_incompat; 	/* incompatible feature set */
 	__u32	s_feature_ro_compat; 	/* readonly-compatible feature set */
-	__u32	s_reserved[230];	/* Padding to the end of the block */
+	__u8	s_uuid[16];		/* 128-bit uuid for volume */
+	char	s_volume_name[16]; 	/* volume name */
+	char	s_last_mounted[64]; 	/* directory where last mounted */
+	__u32	s_algorithm_usage_bitmap; /* For compression */
+	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
+	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
+	__u16	s_padding1;
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+	__u32	s_default_mount_opts;
+	__u32	s_first_meta_bg; 	/* First metablock block group */
+	__u32	s_reserved_ext3[22];	/* journal backup and 64-bit fields */
+	__u32	s_flags;		/* Miscellaneous flags */
+	__u32	s_reserved[167];	/* Padding to the end of the block */
 };
 
 /*
@@ -183,3 +222,5 @@ struct ext2_dir_entry {
 	__u8	file_type;		/* file type */
 	char	name[EXT2_NAME_LEN];	/* File name */
 };
+
+#endif /* _EXT2_FS_H */
@@ -0,0 +1,151 @@
+#include "extract.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "filesystem.h"
+#include "lookup.h"
+
+namespace {
+
+bool pwrite_all(int fd, const char *data, size_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Copies `len` bytes at `src_offset` in the image to `dst_offset` in `dst`.
+// copy_file_range lets the kernel move the data (or share it, on filesystems
+// with reflinks) without it passing through user space. It only works between
+// plain files on some filesystems, so the first failure turns it off.
+bool copy_range(ext2_image &image, int dst, uint64_t src_offset, uint64_t dst_offset, uint64_t len,
+                bool &use_copy_file_range)
+{
+    if (use_copy_file_range) {
+        loff_t in_off = src_offset, out_off = dst_offset;
+        uint64_t left = len;
+        while (left > 0) {
+            ssize_t n = copy_file_range(image.fd(), &in_off, dst, &out_off, left, 0);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) { continue; }
+                break;
+            }
+            left -= n;
+        }
+        if (left == 0) { return true; }
+        use_copy_file_range = false;
+        src_offset += len - left;
+        dst_offset += len - left;
+        len = left;
+    }
+    if (image.is_mapped()) {
+        image.advise(src_offset, len, access_hint::sequential);
+        image_view data = image.view(src_offset, len);
+        return data && pwrite_all(dst, data.data(), data.size(), dst_offset);
+    }
+    // the std::fstream fallback, a large buffer at a time
+    std::vector<char> buffer(std::min<uint64_t>(len, 8 << 20));
+    while (len > 0) {
+        size_t n = std::min<uint64_t>(len, buffer.size());
+        if (!image.read(src_offset, buffer.data(), n) || !pwrite_all(dst, buffer.data(), n, dst_offset)) {
+            return false;
+        }
+        src_offset += n;
+        dst_offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+} // namespace
+
+int extract_file(const char *in_file, const char *target, const char *dest, bool use_mmap,
+                 bool direct, size_t cache_bytes)
+{
+    ext2_image image;
+    if (!image.open(in_file, use_mmap, direct))
+    {
+        std::cerr << "Could not open file" << std::endl;
+        return 1;
+    }
+    image.advise(access_hint::random);
+    ext2_layout layout;
+    if (!read_superblock(image, layout) || !read_group_descriptors(image, layout)) {
+        std::cerr << "error: could not read superblock or block group descriptor table" << std::endl;
+        return 1;
+    }
+    // read errors go straight to stderr
+    csv_writer errors(STDERR_FILENO);
+    block_cache cache(image, layout.block_size, cache_bytes);
+
+    uint32_t inode_num = 0;
+    uint64_t number;
+    if (isdigit((unsigned char)target[0])) {
+        // a number past the inode count is not taken for a file name
+        if (!parse_number(target, layout.sb->s_inodes_count, number)) {
+            std::cerr << "error: " << target << " is not an inode number of this image" << std::endl;
+            return 1;
+        }
+        inode_num = number;
+    } else {
+        path_resolver resolver(image, layout, cache);
+        inode_num = resolver.resolve(target, errors);
+    }
+    ext2_inode inode;
+    if (inode_num == 0 || !read_inode(image, layout, inode_num, inode)) {
+        errors.flush();
+        std::cerr << "error: " << target << ": no such file or directory" << std::endl;
+        return 1;
+    }
+    if (inode_file_type(inode) != 'f') {
+        std::cerr << "error: " << target << " is not a regular file" << std::endl;
+        return 1;
+    }
+
+    std::vector<block_run> runs;
+    bool ok = collect_block_runs(inode, cache, errors, runs);
+    errors.flush();
+    if (!ok) { return 1; }
+
+    int dst = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dst < 0) {
+        std::cerr << "error: could not create " << dest << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    uint64_t file_size = inode_file_size(inode);
+    // copy_file_range would go through the page cache, which --direct stays out of
+    bool use_copy_file_range = image.is_regular_file() && !image.is_direct();
+    for (const block_run &run : runs) {
+        // the last block is only partly used, and blocks past the end are ignored
+        uint64_t offset = run.logical * layout.block_size;
+        if (offset >= file_size) { continue; }
+        uint64_t len = std::min<uint64_t>(run.count * layout.block_size, file_size - offset);
+        if (!copy_range(image, dst, run.physical * layout.block_size, offset, len, use_copy_file_range)) {
+            std::cerr << "error: could not copy block " << run.physical << " to " << dest << std::endl;
+            close(dst);
+            return 1;
+        }
+    }
+    // unmapped blocks were never written, so they read back as zeros without
+    // taking up space; this also covers a hole at the end of the file
+    if (ftruncate(dst, file_size) != 0 || close(dst) != 0) {
+        std::cerr << "error: could not write " << dest << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    return 0;
+}
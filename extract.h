@@ -0,0 +1,15 @@
+#ifndef EXT2_EXTRACT_H
+#define EXT2_EXTRACT_H
+
+#include <cstddef>
+
+// Copies the contents of one regular file out of the image (`--extract`).
+// `target` is an inode number or an absolute path inside the image. The
+// block map is walked once and physically contiguous blocks are copied with
+// one copy_file_range (or one write straight from the mapped image). Unmapped
+// blocks are skipped, so they become holes in `dest`.
+// Returns 1 (with a message on stderr) on failure, 0 otherwise.
+int extract_file(const char *in_file, const char *target, const char *dest, bool use_mmap,
+                 bool direct, size_t cache_bytes);
+
+#endif // EXT2_EXTRACT_H
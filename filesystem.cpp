@@ -0,0 +1,214 @@
+#include "filesystem.h"
+
+#include "bitmap.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool read_superblock(ext2_image& image, ext2_layout& layout)
+{
+    // An Ext2 file systems starts with a superblock located at byte offset 1024 from the start of the volume.
+    return set_superblock(layout, image.view(BYTES_PRE_SUPER_BLOCK, sizeof(ext2_super_block)));
+}
+
+bool set_superblock(ext2_layout& layout, image_view sb_view)
+{
+    layout.sb_view = std::move(sb_view);
+    if (!layout.sb_view) { return false; }
+    layout.sb = layout.sb_view.at<ext2_super_block>(0);
+    const ext2_super_block &sb = *layout.sb;
+    // blocks are 1K to 64K; a larger shift would overflow the block size
+    if (sb.s_log_block_size > 6) { return false; }
+    layout.block_size = EXT2_MIN_BLOCK_SIZE << sb.s_log_block_size;
+    // inode table entries are used as a stride and must each hold an ext2_inode
+    uint32_t stride = inode_size(sb);
+    if (stride < sizeof(ext2_inode) || (stride & (stride - 1)) != 0 || stride > layout.block_size) { return false; }
+    // Depending on how many block groups are defined, the Block Group Descriptor
+    // table can require multiple blocks of storage.
+    if (sb.s_blocks_per_group == 0 || sb.s_first_data_block >= sb.s_blocks_count) { return false; }
+    layout.group_count = ((uint64_t)sb.s_blocks_count - sb.s_first_data_block + sb.s_blocks_per_group - 1) /
+                         sb.s_blocks_per_group;
+    return true;
+}
+
+bool read_group_descriptors(ext2_image& image, ext2_layout& layout)
+{
+    // The whole descriptor table is viewed at once. It starts in the block after
+    // the superblock: block 2 with 1K blocks (the superblock is block 1),
+    // block 1 with larger blocks (the superblock shares block 0 with the boot block).
+    uint64_t gdt_pos = (uint64_t)(layout.sb->s_first_data_block + 1) * layout.block_size;
+    layout.gdt_view = image.view(gdt_pos, (uint64_t)layout.group_count * sizeof(ext2_group_desc));
+    return (bool)layout.gdt_view;
+}
+
+bool read_inode(ext2_image& image, const ext2_layout& layout, uint32_t inode_num, ext2_inode& inode)
+{
+    const ext2_super_block &sb = *layout.sb;
+    if (inode_num == 0 || inode_num > sb.s_inodes_count || sb.s_inodes_per_group == 0) { return false; }
+    uint32_t group = (inode_num - 1) / sb.s_inodes_per_group;
+    uint32_t index = (inode_num - 1) % sb.s_inodes_per_group;
+    if (group >= (uint32_t)layout.group_count) { return false; }
+    uint64_t pos = (uint64_t)layout.group_desc(group).bg_inode_table * layout.block_size +
+                   (uint64_t)index * layout.inode_size();
+    // only the classic 128 byte part of larger inodes is used
+    size_t len = std::min<size_t>(layout.inode_size(), sizeof(ext2_inode));
+    memset(&inode, 0, sizeof(inode));
+    return image.read(pos, &inode, len);
+}
+
+bool has_superblock(const ext2_super_block& sb, int group)
+{
+    if (group <= 1 || !(sb.s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER)) { return true; }
+    for (int base : {3, 5, 7}) {
+        int n = group;
+        while (n % base == 0) { n /= base; }
+        if (n == 1) { return true; }
+    }
+    return false;
+}
+
+void print_free_blocks(const char* bitmap, uint32_t nbits, uint32_t first_block, bool ranges,
+                       record_writer& out)
+{
+    // report every clear bit (free block) in the block group
+    if (ranges) {
+        for_each_free_run(bitmap, nbits, [&](uint32_t first, uint32_t count) {
+            out.bfree_range(first_block + first, count);
+        });
+    } else {
+        for_each_free_bit(bitmap, nbits, [&](uint32_t i) {
+            out.bfree(first_block + i);
+        });
+    }
+}
+
+void print_free_inodes(const char* bitmap, uint32_t nbits, uint32_t first_inode, bool ranges,
+                       record_writer& out, uint32_t from)
+{
+    // start at the word holding bit `from` and drop the bits in front of it
+    uint32_t base = from & ~63u;
+    if (base >= nbits) { return; }
+    bitmap += base / 8;
+    nbits -= base;
+    first_inode += base;
+    from -= base;
+    // report every clear bit (free inode) in the block group
+    if (ranges) {
+        for_each_free_run(bitmap, nbits, [&](uint32_t first, uint32_t count) {
+            if (first + count <= from) { return; }
+            if (first < from) {
+                count -= from - first;
+                first = from;
+            }
+            out.ifree_range(first_inode + first + 1, count);
+        });
+    } else {
+        for_each_free_bit(bitmap, nbits, [&](uint32_t i) {
+            if (i >= from) { out.ifree(first_inode + i + 1); }
+        });
+    }
+}
+
+cached_block get_indirect_block(uint ind_block, block_cache& cache, record_writer& out)
+{
+    cached_block block = cache.get(ind_block);
+    if (!block) {
+        out.message("error: could not read indirect block\n");
+    }
+    return block;
+}
+
+bool print_all_indirect_blocks(const ext2_inode& inode_table, int32_t inode, block_cache& cache,
+                               record_writer& out)
+{
+    return for_each_indirect_pointer(inode_table, cache, out, [](int, uint32_t) {},
+        [&](int level, uint32_t logical, uint32_t ind_block, uint32_t block) {
+            out.indirect(inode + 1, level, logical, ind_block, block);
+        });
+}
+
+uint32_t map_logical_block(const ext2_inode& inode_table, uint32_t logical, block_cache& cache, record_writer& out)
+{
+    if (logical < EXT2_NDIR_BLOCKS) { return inode_table.i_block[logical]; }
+    uint64_t index = logical - EXT2_NDIR_BLOCKS;
+    uint32_t per_block = cache.block_size() / sizeof(__u32);
+    // number of data blocks below each pointer of the top indirect block
+    uint64_t span = 1;
+    for (int level = 1; level <= 3; level++) {
+        if (index >= span * per_block) {
+            index -= span * per_block;
+            span *= per_block;
+            continue;
+        }
+        uint32_t block = inode_table.i_block[EXT2_IND_BLOCK + level - 1];
+        for (; block != 0; span /= per_block) {
+            cached_block ind_block = get_indirect_block(block, cache, out);
+            if (!ind_block) { return 0; }
+            const __u32 *block_numbers = ind_block->at<__u32>(0, cache.block_size());
+            if (block_numbers == nullptr) { return 0; }
+            block = block_numbers[index / span];
+            index %= span;
+            if (span == 1) { return block; }
+        }
+        return 0;
+    }
+    return 0;
+}
+
+bool collect_block_runs(const ext2_inode &inode_table, block_cache &cache, record_writer &out,
+                        std::vector<block_run> &runs)
+{
+    runs.clear();
+    return for_each_mapped_block(inode_table, cache, out,
+        [&runs](uint32_t logical, uint32_t block) {
+            if (!runs.empty()) {
+                block_run &last = runs.back();
+                if (logical == last.logical + last.count && block == last.physical + last.count) {
+                    last.count++;
+                    return;
+                }
+            }
+            runs.push_back({logical, block, 1});
+        },
+        [](int, uint32_t) {});
+}
+
+bool print_extents(const ext2_inode& inode_table, int32_t inode, block_cache& cache, record_writer& out)
+{
+    // the runs being extended, printed once a block doesn't continue them
+    uint32_t logical_start = 0, physical_start = 0, length = 0;
+    uint32_t meta_start = 0, meta_length = 0;
+    bool ok = for_each_mapped_block(inode_table, cache, out,
+        [&](uint32_t logical, uint32_t block) {
+            if (length != 0 && logical == logical_start + length && block == physical_start + length) {
+                length++;
+                return;
+            }
+            if (length != 0) { out.extent(inode + 1, logical_start, physical_start, length); }
+            logical_start = logical;
+            physical_start = block;
+            length = 1;
+        },
+        [&](int, uint32_t block) {
+            if (meta_length != 0 && block == meta_start + meta_length) {
+                meta_length++;
+                return;
+            }
+            if (meta_length != 0) { out.meta_extent(inode + 1, meta_start, meta_length); }
+            meta_start = block;
+            meta_length = 1;
+        });
+    if (length != 0) { out.extent(inode + 1, logical_start, physical_start, length); }
+    if (meta_length != 0) { out.meta_extent(inode + 1, meta_start, meta_length); }
+    return ok;
+}
+
+bool print_directory_entries(const ext2_inode& inode_table, int inode_num, block_cache& cache,
+                             record_writer& out)
+{
+    // READ the DIRECTORY ENTRIES
+    // For each directory I-node, scan every data block.
+    return for_each_dir_entry(inode_table, cache, out, [&](uint64_t offset, const ext2_dir_entry& entry) {
+        out.dirent(inode_num + 1, offset, entry);
+    });
+}
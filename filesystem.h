@@ -0,0 +1,352 @@
+#ifndef EXT2_FILESYSTEM_H
+#define EXT2_FILESYSTEM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "ext2_fs.h"
+#include "image.h"
+#include "block_cache.h"
+#include "records.h"
+
+// The on-disk structures the scan and the path lookup walk: the superblock,
+// the group descriptor table, inodes, indirect blocks and directory entries.
+
+#define BYTES_PRE_SUPER_BLOCK 1024
+
+// size of one inode table entry (always 128 bytes in revision 0 filesystems),
+// checked by `set_superblock` to be a power of two from 128 to the block size
+inline uint32_t inode_size(const ext2_super_block &sb)
+{
+    return sb.s_rev_level == 0 ? 128 : sb.s_inode_size;
+}
+
+// Number of blocks in `group`. Every group but the last is full. The count
+// starts at block 0, so with 1K blocks the first group's count includes the
+// boot block in front of the superblock.
+inline int32_t group_block_count(const ext2_super_block &sb, int group)
+{
+    uint64_t first = (uint64_t)sb.s_blocks_per_group * group;
+    if (first >= sb.s_blocks_count) { return 0; }
+    return std::min<uint64_t>(sb.s_blocks_per_group, sb.s_blocks_count - first);
+}
+
+inline int32_t group_inode_count(const ext2_super_block &sb, int group)
+{
+    uint64_t first = (uint64_t)sb.s_inodes_per_group * group;
+    if (first >= sb.s_inodes_count) { return 0; }
+    return std::min<uint64_t>(sb.s_inodes_per_group, sb.s_inodes_count - first);
+}
+
+// Block number of bit 0 of `group`'s block bitmap
+inline uint32_t group_first_block(const ext2_super_block &sb, int group)
+{
+    return sb.s_first_data_block + sb.s_blocks_per_group * group;
+}
+
+// Groups 0 and 1 and the powers of 3, 5 and 7 keep a backup of the superblock
+// and group descriptors when the filesystem has the sparse_super feature
+bool has_superblock(const ext2_super_block &sb, int group);
+
+// Buffers a scan reuses from group to group (one set per worker), so that
+// scanning doesn't allocate once they have grown to their working size
+struct scan_arena
+{
+    // inode table chunks, when the image isn't memory mapped
+    std::vector<char> inode_table;
+};
+
+// The superblock and block group descriptor table of an image, read in place
+struct ext2_layout
+{
+    image_view sb_view;
+    const ext2_super_block *sb = nullptr;
+    image_view gdt_view;
+    int group_count = 0;
+    // 1024 << s_log_block_size
+    uint32_t block_size = 0;
+
+    const ext2_group_desc &group_desc(int group) const
+    {
+        return *gdt_view.at<ext2_group_desc>(group * sizeof(ext2_group_desc));
+    }
+    uint32_t inode_size() const { return ::inode_size(*sb); }
+};
+
+// Reads the superblock into `layout` and works out its block size and group count
+bool read_superblock(ext2_image &image, ext2_layout &layout);
+// The same for a superblock that was already read into `sb_view`
+bool set_superblock(ext2_layout &layout, image_view sb_view);
+// Reads the block group descriptor table, after `read_superblock`
+bool read_group_descriptors(ext2_image &image, ext2_layout &layout);
+// Copies inode number `inode_num` (1 based, counted across all groups) into `inode`
+bool read_inode(ext2_image &image, const ext2_layout &layout, uint32_t inode_num, ext2_inode &inode);
+
+// Prints the BFREE records (BFREE_RANGE with `ranges`) of the `nbits` bit block
+// bitmap whose bit 0 is block `first_block`
+void print_free_blocks(const char *bitmap, uint32_t nbits, uint32_t first_block, bool ranges,
+                       record_writer &out);
+// The IFREE (or IFREE_RANGE) records of an inode bitmap, `first_inode` is the
+// zero based index of the inode of bit 0. Bits below `from` are not reported.
+void print_free_inodes(const char *bitmap, uint32_t nbits, uint32_t first_inode, bool ranges,
+                       record_writer &out, uint32_t from = 0);
+
+// Size of a file in bytes. Revision 1 filesystems keep the high 32 bits of a
+// regular file's size in `i_dir_acl`.
+inline uint64_t inode_file_size(const ext2_inode &inode)
+{
+    uint64_t size = inode.i_size;
+    if (inode_file_type(inode) == 'f') { size |= (uint64_t)inode.i_dir_acl << 32; }
+    return size;
+}
+
+// Returns the whole indirect block so that its block numbers can be read in place
+cached_block get_indirect_block(uint ind_block, block_cache &cache, record_writer &out);
+
+// Prints the INDIRECT records of all three indirect block pointers of
+// `inode_table`. `inode` is the zero based index of the owning inode.
+bool print_all_indirect_blocks(const ext2_inode &inode_table, int32_t inode, block_cache &cache,
+                               record_writer &out);
+
+// Whether the four block pointers starting at `pointers` are all 0. Sparse
+// indirect blocks are skipped a group of pointers at a time.
+inline bool zero_pointers4(const __u32 *pointers)
+{
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)pointers);
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(v, _mm_setzero_si128())) == 0xFFFF;
+#else
+    uint64_t words[2];
+    memcpy(words, pointers, sizeof(words));
+    return (words[0] | words[1]) == 0;
+#endif
+}
+
+// Number of data blocks below each pointer of an indirect block of `level`
+// (1 single, 2 double, 3 triple) with `per_block` pointers
+inline uint64_t indirect_span(uint32_t per_block, int level)
+{
+    uint64_t span = 1;
+    for (int i = 1; i < level; i++) { span *= per_block; }
+    return span;
+}
+
+// Logical number of the first data block of an inode's `level` indirect tree
+inline uint64_t indirect_tree_start(uint32_t per_block, int level)
+{
+    uint64_t start = EXT2_NDIR_BLOCKS;
+    for (int i = 1; i < level; i++) { start += indirect_span(per_block, i + 1); }
+    return start;
+}
+
+// Block numbers within a file are 32 bits; with 8K and larger blocks the
+// triple indirect tree spans more, which only a corrupt block map reaches
+inline bool valid_logical_block(uint64_t logical)
+{
+    return logical <= UINT32_MAX;
+}
+
+// Calls `visit(level, logical, ind_block, block)` for every non-zero pointer
+// `block` of the indirect block `ind_block` of `Level` (1 single, 2 double,
+// 3 triple) and of the indirect blocks below it, each pointer before the
+// blocks it leads to. `logical` is the logical number of the first data block
+// below a pointer. `PerBlock` is the number of pointers in a block, known at
+// compile time for the common block sizes so that the loops and the span of
+// each pointer are constants; 0 takes it from `per_block` instead. A pointer
+// past the last logical block is reported as an error.
+template <uint32_t PerBlock, int Level, typename Visit>
+bool walk_indirect_block(uint32_t ind_block, uint64_t logical, uint32_t per_block, block_cache &cache,
+                         record_writer &out, Visit &visit)
+{
+    const uint32_t count = PerBlock != 0 ? PerBlock : per_block;
+    cached_block block = get_indirect_block(ind_block, cache, out);
+    if (!block) { return false; }
+    const __u32 *block_numbers = block->at<__u32>(0, (size_t)count * sizeof(__u32));
+    if (block_numbers == nullptr) {
+        out.message("error: could not read indirect block\n");
+        return false;
+    }
+    const uint64_t span = indirect_span(count, Level);
+    for (uint32_t i = 0; i < count; i++) {
+        // every block size is a multiple of 16 bytes
+        if (i % 4 == 0 && zero_pointers4(block_numbers + i)) {
+            i += 3;
+            continue;
+        }
+        if (block_numbers[i] == 0) { continue; }
+        uint64_t first = logical + i * span;
+        if (!valid_logical_block(first)) {
+            out.message("error: indirect block " + std::to_string(ind_block) + " maps blocks past the last "
+                        "logical block\n");
+            return false;
+        }
+        visit(Level, (uint32_t)first, ind_block, block_numbers[i]);
+        if constexpr (Level > 1) {
+            if (!walk_indirect_block<PerBlock, Level - 1>(block_numbers[i], first, per_block, cache, out,
+                                                          visit)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Walks the three indirect trees of `inode_table`: `top(level, block)` for the
+// indirect block the inode points to, then `visit` for every pointer below it
+template <uint32_t PerBlock, typename Top, typename Visit>
+bool walk_indirect_trees(const ext2_inode &inode_table, uint32_t per_block, block_cache &cache,
+                         record_writer &out, Top &top, Visit &visit)
+{
+    const uint32_t count = PerBlock != 0 ? PerBlock : per_block;
+    const uint32_t *ind = &inode_table.i_block[EXT2_IND_BLOCK];
+    if (ind[0] != 0) {
+        top(1, ind[0]);
+        if (!walk_indirect_block<PerBlock, 1>(ind[0], indirect_tree_start(count, 1), per_block, cache, out,
+                                              visit)) {
+            return false;
+        }
+    }
+    if (ind[1] != 0) {
+        top(2, ind[1]);
+        if (!walk_indirect_block<PerBlock, 2>(ind[1], indirect_tree_start(count, 2), per_block, cache, out,
+                                              visit)) {
+            return false;
+        }
+    }
+    if (ind[2] != 0) {
+        top(3, ind[2]);
+        if (!walk_indirect_block<PerBlock, 3>(ind[2], indirect_tree_start(count, 3), per_block, cache, out,
+                                              visit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Walks the indirect trees of `inode_table` (see `walk_indirect_trees`) with
+// the walker specialized for the image's block size
+template <typename Top, typename Visit>
+bool for_each_indirect_pointer(const ext2_inode &inode_table, block_cache &cache, record_writer &out,
+                               Top &&top, Visit &&visit)
+{
+    uint32_t per_block = cache.block_size() / sizeof(__u32);
+    switch (per_block) {
+    case 256: return walk_indirect_trees<256>(inode_table, per_block, cache, out, top, visit);
+    case 512: return walk_indirect_trees<512>(inode_table, per_block, cache, out, top, visit);
+    case 1024: return walk_indirect_trees<1024>(inode_table, per_block, cache, out, top, visit);
+    default: return walk_indirect_trees<0>(inode_table, per_block, cache, out, top, visit);
+    }
+}
+
+// Walks the whole block map of an inode once: calls `data(logical, block)` for
+// every mapped data block in logical order, and `meta(level, block)` for every
+// indirect block just before the blocks it points to. Holes are skipped.
+template <typename Data, typename Meta>
+bool for_each_mapped_block(const ext2_inode &inode_table, block_cache &cache, record_writer &out,
+                           Data &&data, Meta &&meta)
+{
+    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+        if (inode_table.i_block[i] != 0) { data(i, inode_table.i_block[i]); }
+    }
+    return for_each_indirect_pointer(inode_table, cache, out, meta,
+        [&](int level, uint32_t logical, uint32_t, uint32_t block) {
+            if (level == 1) {
+                data(logical, block);
+            } else {
+                meta(level - 1, block);
+            }
+        });
+}
+
+// A run of blocks that are consecutive both in the file and on disk
+struct block_run
+{
+    uint64_t logical;
+    uint64_t physical;
+    uint64_t count;
+};
+
+// Walks the block map of `inode_table` into `runs` (cleared first), in logical
+// order, so that copying or hashing the file is not interleaved with reading
+// its indirect blocks. Returns false (with a message) if one couldn't be read.
+bool collect_block_runs(const ext2_inode &inode_table, block_cache &cache, record_writer &out,
+                        std::vector<block_run> &runs);
+
+// Prints the block map of `inode_table` as EXTENT records (runs of data blocks
+// whose logical and physical numbers advance together) and META_EXTENT records
+// (runs of physically consecutive indirect blocks). `inode` is the zero based
+// index of the owning inode.
+bool print_extents(const ext2_inode &inode_table, int32_t inode, block_cache &cache, record_writer &out);
+
+// Physical block number of block `logical` of `inode_table`, found by going
+// down its indirect blocks, or 0 for a hole or a block that can't be read
+uint32_t map_logical_block(const ext2_inode &inode_table, uint32_t logical, block_cache &cache, record_writer &out);
+
+// Calls `fn(offset, entry)` for every used entry of one directory block, read
+// in place. `start` is the offset of the block in a directory of `dir_size`
+// bytes, entries past the end of the directory are ignored. Returns false if
+// an entry doesn't fit in the block.
+template <typename Fn>
+bool for_each_block_entry(const image_view &block, uint64_t start, uint64_t dir_size, Fn &&fn)
+{
+    for (size_t offset = 0; offset < block.size() && start + offset < dir_size;) {
+        // Only the fixed part of the entry and the first name_len bytes of the
+        // name have to lie inside the block
+        const ext2_dir_entry *entry = block.at<ext2_dir_entry>(offset, offsetof(ext2_dir_entry, name));
+        if (entry != nullptr) {
+            entry = block.at<ext2_dir_entry>(offset, offsetof(ext2_dir_entry, name) + entry->name_len);
+        }
+        if (entry == nullptr) { return false; }
+        // rec_len is 16 bits, so 64K blocks store an entry covering the whole
+        // block as 65535 (or 0)
+        uint32_t rec_len = entry->rec_len;
+        if (block.size() == 65536 && offset == 0 && (rec_len == 0 || rec_len == 65535)) { rec_len = 65536; }
+        if (rec_len == 0) { return false; }
+        if (entry->inode != 0) { fn(start + offset, *entry); }
+        offset += rec_len;
+    }
+    return true;
+}
+
+// Calls `fn(offset, entry)` for every used entry of a directory, with `offset`
+// counted from the start of the directory. The directory is walked one whole
+// block at a time in logical order, through all three levels of indirect
+// blocks, and the entries are read in place from the cached blocks. Indexed
+// (htree) directories are read the same way: their index blocks look like
+// blocks holding a single unused entry. Errors are reported through `out`.
+template <typename Fn>
+bool for_each_dir_entry(const ext2_inode &inode_table, block_cache &cache, record_writer &out, Fn &&fn)
+{
+    uint64_t dir_size = inode_table.i_size;
+    bool ok = true;
+    bool walked = for_each_mapped_block(inode_table, cache, out,
+        [&](uint32_t logical, uint32_t block) {
+            uint64_t start = (uint64_t)logical * cache.block_size();
+            if (!ok || start >= dir_size) { return; }
+            cached_block dir_block = cache.get(block);
+            if (!dir_block) {
+                out.message("error: could not read directory data block\n");
+                ok = false;
+            } else if (!for_each_block_entry(*dir_block, start, dir_size, fn)) {
+                out.message("error: could not read data into directory data block\n");
+                ok = false;
+            }
+        },
+        [](int, uint32_t) {});
+    return walked && ok;
+}
+
+// Prints the DIRENT records of a directory. `inode_num` is the zero based index of the directory inode.
+bool print_directory_entries(const ext2_inode &inode_table, int inode_num, block_cache &cache,
+                             record_writer &out);
+
+#endif // EXT2_FILESYSTEM_H
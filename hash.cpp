@@ -0,0 +1,206 @@
+#include "hash.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t rotr(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+// The reflected Castagnoli polynomial
+const uint32_t crc32c_poly = 0x82F63B78;
+
+// table[k][b] is the CRC of byte `b` followed by `k` zero bytes
+struct crc32c_tables
+{
+    uint32_t table[8][256];
+
+    crc32c_tables()
+    {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t crc = b;
+            for (int i = 0; i < 8; i++) { crc = (crc >> 1) ^ (crc & 1 ? crc32c_poly : 0); }
+            table[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; b++) {
+            for (int k = 1; k < 8; k++) { table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF]; }
+        }
+    }
+};
+
+const crc32c_tables tables;
+
+uint32_t crc32c_portable(uint32_t crc, const unsigned char *p, size_t len)
+{
+    const auto &t = tables.table;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^
+              t[4][(word >> 24) & 0xFF] ^ t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^
+              t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) { crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF]; }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Built for SSE4.2 whatever the rest of the program targets, and only called
+// once the CPU has been checked for it
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = crc64;
+    while (len-- > 0) { crc = _mm_crc32_u8(crc, *p++); }
+    return crc;
+}
+
+__attribute__((target("sse4.2"))) void crc32c_pair_sse42(const unsigned char *a, const unsigned char *b,
+                                                         size_t len, uint32_t crc[2])
+{
+    uint64_t crc_a = crc[0], crc_b = crc[1];
+    size_t words = len / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word_a, word_b;
+        memcpy(&word_a, a + i * 8, sizeof(word_a));
+        memcpy(&word_b, b + i * 8, sizeof(word_b));
+        crc_a = _mm_crc32_u64(crc_a, word_a);
+        crc_b = _mm_crc32_u64(crc_b, word_b);
+    }
+    crc[0] = crc32c_sse42(crc_a, a + words * 8, len % 8);
+    crc[1] = crc32c_sse42(crc_b, b + words * 8, len % 8);
+}
+
+const bool have_sse42 = __builtin_cpu_supports("sse4.2");
+#else
+const bool have_sse42 = false;
+#endif
+
+} // namespace
+
+uint32_t crc32c(const void *data, size_t len, uint32_t crc)
+{
+    const unsigned char *p = (const unsigned char *)data;
+#if defined(__x86_64__)
+    if (have_sse42) { return ~crc32c_sse42(~crc, p, len); }
+#endif
+    return ~crc32c_portable(~crc, p, len);
+}
+
+void crc32c_pair(const void *a, const void *b, size_t len, uint32_t crc[2])
+{
+#if defined(__x86_64__)
+    if (have_sse42) {
+        uint32_t state[2] = {~crc[0], ~crc[1]};
+        crc32c_pair_sse42((const unsigned char *)a, (const unsigned char *)b, len, state);
+        crc[0] = ~state[0];
+        crc[1] = ~state[1];
+        return;
+    }
+#endif
+    crc[0] = crc32c(a, len, crc[0]);
+    crc[1] = crc32c(b, len, crc[1]);
+}
+
+sha256_state::sha256_state()
+{
+    const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(h_, initial, sizeof(h_));
+}
+
+void sha256_state::update(const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    total_ += len;
+    if (buffered_ != 0) {
+        size_t fill = std::min(len, sizeof(buffer_) - buffered_);
+        memcpy(buffer_ + buffered_, p, fill);
+        buffered_ += fill;
+        p += fill;
+        len -= fill;
+        if (buffered_ < sizeof(buffer_)) { return; }
+        consume(buffer_);
+        buffered_ = 0;
+    }
+    while (len >= 64) {
+        consume(p);
+        p += 64;
+        len -= 64;
+    }
+    memcpy(buffer_, p, len);
+    buffered_ = len;
+}
+
+void sha256_state::digest(unsigned char out[digest_size])
+{
+    // a 1 bit, zeros up to 8 bytes short of a block, then the length in bits
+    uint64_t bits = total_ * 8;
+    unsigned char padding[72] = {0x80};
+    size_t pad = (buffered_ < 56 ? 56 : 120) - buffered_;
+    for (int i = 0; i < 8; i++) { padding[pad + i] = bits >> (56 - 8 * i); }
+    update(padding, pad + 8);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) { out[4 * i + j] = h_[i] >> (24 - 8 * j); }
+    }
+}
+
+void sha256_state::consume(const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 |
+               block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h_[0] += a;
+    h_[1] += b;
+    h_[2] += c;
+    h_[3] += d;
+    h_[4] += e;
+    h_[5] += f;
+    h_[6] += g;
+    h_[7] += h;
+}
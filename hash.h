@@ -0,0 +1,185 @@
+#ifndef EXT2_HASH_H
+#define EXT2_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// XXH64 (https://github.com/Cyan4973/xxHash), a fast non-cryptographic 64-bit hash.
+// `xxh64_state` hashes data that arrives in pieces and gives the same result
+// as hashing it all at once with `xxh64`.
+
+namespace xxh64_detail {
+
+const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t prime3 = 0x165667B19E3779F9ULL;
+const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= round(0, val);
+    return acc * prime1 + prime4;
+}
+
+} // namespace xxh64_detail
+
+class xxh64_state
+{
+public:
+    explicit xxh64_state(uint64_t seed = 0)
+    {
+        using namespace xxh64_detail;
+        v_[0] = seed + prime1 + prime2;
+        v_[1] = seed + prime2;
+        v_[2] = seed;
+        v_[3] = seed - prime1;
+        seed_ = seed;
+    }
+
+    void update(const void *data, size_t len)
+    {
+        using namespace xxh64_detail;
+        const unsigned char *p = (const unsigned char *)data;
+        total_ += len;
+        if (buffered_ + len < 32) {
+            memcpy(buffer_ + buffered_, p, len);
+            buffered_ += len;
+            return;
+        }
+        if (buffered_ != 0) {
+            size_t fill = 32 - buffered_;
+            memcpy(buffer_ + buffered_, p, fill);
+            consume(buffer_);
+            p += fill;
+            len -= fill;
+            buffered_ = 0;
+        }
+        while (len >= 32) {
+            consume(p);
+            p += 32;
+            len -= 32;
+        }
+        memcpy(buffer_, p, len);
+        buffered_ = len;
+    }
+
+    uint64_t digest() const
+    {
+        using namespace xxh64_detail;
+        uint64_t h;
+        if (total_ >= 32) {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) + rotl(v_[3], 18);
+            for (int i = 0; i < 4; i++) { h = merge_round(h, v_[i]); }
+        } else {
+            h = seed_ + prime5;
+        }
+        h += total_;
+        const unsigned char *p = buffer_;
+        size_t len = buffered_;
+        while (len >= 8) {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * prime1 + prime4;
+            p += 8;
+            len -= 8;
+        }
+        if (len >= 4) {
+            h ^= (uint64_t)read32(p) * prime1;
+            h = rotl(h, 23) * prime2 + prime3;
+            p += 4;
+            len -= 4;
+        }
+        while (len > 0) {
+            h ^= (*p) * prime5;
+            h = rotl(h, 11) * prime1;
+            p++;
+            len--;
+        }
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    void consume(const unsigned char *p)
+    {
+        using namespace xxh64_detail;
+        v_[0] = round(v_[0], read64(p));
+        v_[1] = round(v_[1], read64(p + 8));
+        v_[2] = round(v_[2], read64(p + 16));
+        v_[3] = round(v_[3], read64(p + 24));
+    }
+
+    uint64_t v_[4];
+    uint64_t seed_;
+    uint64_t total_ = 0;
+    unsigned char buffer_[32];
+    size_t buffered_ = 0;
+};
+
+inline uint64_t xxh64(const void *data, size_t len, uint64_t seed = 0)
+{
+    xxh64_state state(seed);
+    state.update(data, len);
+    return state.digest();
+}
+
+// SHA-256 (FIPS 180-4), for when a digest has to resist deliberate
+// collisions. Like `xxh64_state` it hashes data that arrives in pieces.
+class sha256_state
+{
+public:
+    static const size_t digest_size = 32;
+
+    sha256_state();
+
+    void update(const void *data, size_t len);
+    // Pads what was hashed so far and writes its digest to `out`
+    void digest(unsigned char out[digest_size]);
+
+private:
+    void consume(const unsigned char *block);
+
+    uint32_t h_[8];
+    uint64_t total_ = 0;
+    unsigned char buffer_[64];
+    size_t buffered_ = 0;
+};
+
+// CRC-32C (Castagnoli), computed with the SSE4.2 crc32 instruction when the
+// CPU has it and with slicing-by-8 tables otherwise. `crc` is the result for
+// the data before `data`, to continue a checksum.
+uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
+// The CRC-32C of `a` and of `b`, both `len` bytes long, into `crc[0]` and
+// `crc[1]`. The two checksums are independent, so the instruction doing one
+// runs while the other waits for its previous result.
+void crc32c_pair(const void *a, const void *b, size_t len, uint32_t crc[2]);
+
+#endif // EXT2_HASH_H
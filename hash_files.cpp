@@ -0,0 +1,295 @@
+#include "hash_files.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+#include "filesystem.h"
+#include "hash.h"
+#include "output.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Files are handed to the workers in batches of about this many bytes (a
+// file counts as at least one block), a larger file is a batch of its own
+const uint64_t batch_bytes = 8 << 20;
+// A run of blocks is read this many bytes at a time
+const uint64_t read_bytes = 8 << 20;
+// Batches queued or being hashed at the same time, per worker. The records
+// of a batch wait for those of the batches before it, so this bounds memory.
+const unsigned batches_per_worker = 4;
+
+struct regular_file
+{
+    uint32_t inode_num;
+    ext2_inode inode;
+};
+
+struct file_batch
+{
+    std::vector<regular_file> files;
+    uint64_t bytes = 0;
+    // the FILEHASH records, and the errors that go to stderr
+    output_sink lines{-1, 4096};
+    csv_writer errors;
+    bool done = false;
+};
+
+// The digest of a file's contents, fed to it in pieces
+class content_hash
+{
+public:
+    explicit content_hash(file_digest kind) : kind_(kind) {}
+
+    void update(const void *data, size_t len)
+    {
+        if (kind_ == file_digest::xxh64) {
+            xxh64_.update(data, len);
+        } else {
+            sha256_.update(data, len);
+        }
+    }
+
+    // `len` zero bytes, for a hole
+    void zeros(uint64_t len)
+    {
+        static const char zero_block[64 << 10] = {};
+        while (len > 0) {
+            size_t n = std::min<uint64_t>(len, sizeof(zero_block));
+            update(zero_block, n);
+            len -= n;
+        }
+    }
+
+    // Prints the digest in hex, XXH64 most significant byte first
+    void print(output_sink &out)
+    {
+        unsigned char digest[sha256_state::digest_size];
+        size_t len = 8;
+        if (kind_ == file_digest::xxh64) {
+            uint64_t h = xxh64_.digest();
+            for (int i = 0; i < 8; i++) { digest[i] = h >> (56 - 8 * i); }
+        } else {
+            sha256_.digest(digest);
+            len = sizeof(digest);
+        }
+        static const char hex[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; i++) { out << hex[digest[i] >> 4] << hex[digest[i] & 15]; }
+    }
+
+private:
+    file_digest kind_;
+    xxh64_state xxh64_;
+    sha256_state sha256_;
+};
+
+// Hashes the regular files of one image on a shared pool
+class image_hasher
+{
+public:
+    image_hasher(ext2_image &image, const ext2_layout &layout, file_digest digest, size_t cache_bytes,
+                 thread_pool &pool);
+
+    // Prints the records of every regular file to `out` in inode order.
+    // Returns false if an inode table or a file couldn't be read.
+    bool run(output_sink &out);
+
+private:
+    // what each worker keeps from one batch to the next
+    struct worker_state
+    {
+        std::unique_ptr<block_cache> cache;
+        std::vector<block_run> runs;
+        // the data of a run when the image isn't mapped
+        std::vector<char> scratch;
+    };
+
+    void hash_batch(file_batch &batch, unsigned worker);
+    bool hash_file(const regular_file &file, worker_state &state, file_batch &batch);
+    // Queues `batch`, first writing out finished batches until there is room for it
+    void submit(std::unique_ptr<file_batch> batch, output_sink &out);
+    // Writes out the finished batches at the front of the queue, all of them
+    // (waiting for those still being hashed) with `all`
+    void write_finished(output_sink &out, bool all);
+
+    ext2_image &image_;
+    const ext2_layout &layout_;
+    file_digest digest_;
+    thread_pool &pool_;
+    std::vector<worker_state> workers_;
+    std::mutex mutex_;
+    std::condition_variable batch_done_;
+    std::deque<std::unique_ptr<file_batch>> queued_;
+    bool ok_ = true;
+};
+
+image_hasher::image_hasher(ext2_image &image, const ext2_layout &layout, file_digest digest, size_t cache_bytes,
+                           thread_pool &pool)
+    : image_(image), layout_(layout), digest_(digest), pool_(pool), workers_(pool.size())
+{
+    for (worker_state &state : workers_) {
+        state.cache = std::make_unique<block_cache>(image, layout.block_size, cache_bytes / pool.size());
+    }
+}
+
+bool image_hasher::hash_file(const regular_file &file, worker_state &state, file_batch &batch)
+{
+    const uint64_t block_size = layout_.block_size;
+    uint64_t size = inode_file_size(file.inode);
+    std::vector<block_run> &runs = state.runs;
+    if (!collect_block_runs(file.inode, *state.cache, batch.errors, runs)) { return false; }
+
+    content_hash hash(digest_);
+    uint64_t hashed = 0;
+    for (const block_run &run : runs) {
+        // the last block is only partly used, and blocks past the end are ignored
+        uint64_t offset = run.logical * block_size;
+        if (offset >= size) { break; }
+        hash.zeros(offset - hashed);
+        uint64_t len = std::min(run.count * block_size, size - offset);
+        uint64_t pos = run.physical * block_size;
+        for (uint64_t done = 0; done < len;) {
+            size_t n = std::min(len - done, read_bytes);
+            image_.advise(pos + done, n, access_hint::willneed);
+            image_view data = image_.view(pos + done, n, state.scratch);
+            if (!data) {
+                batch.errors.message("error: could not read block " + std::to_string((pos + done) / block_size) +
+                                     " of inode " + std::to_string(file.inode_num) + "\n");
+                return false;
+            }
+            hash.update(data.data(), n);
+            done += n;
+        }
+        hashed = offset + len;
+    }
+    hash.zeros(size - hashed);
+    batch.lines << "FILEHASH," << file.inode_num << "," << size << ",";
+    hash.print(batch.lines);
+    batch.lines << "\n";
+    return true;
+}
+
+void image_hasher::hash_batch(file_batch &batch, unsigned worker)
+{
+    bool ok = true;
+    // a file that can't be read is reported and skipped
+    for (const regular_file &file : batch.files) { ok = hash_file(file, workers_[worker], batch) && ok; }
+    std::lock_guard<std::mutex> lock(mutex_);
+    batch.done = true;
+    if (!ok) { ok_ = false; }
+    batch_done_.notify_all();
+}
+
+void image_hasher::write_finished(output_sink &out, bool all)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!queued_.empty()) {
+        if (all) { batch_done_.wait(lock, [this] { return queued_.front()->done; }); }
+        if (!queued_.front()->done) { break; }
+        std::unique_ptr<file_batch> batch = std::move(queued_.front());
+        queued_.pop_front();
+        lock.unlock();
+        out << batch->lines.text();
+        std::string_view errors = batch->errors.sink().text();
+        if (!errors.empty()) {
+            out.flush();
+            std::cerr << errors;
+        }
+        lock.lock();
+    }
+}
+
+void image_hasher::submit(std::unique_ptr<file_batch> batch, output_sink &out)
+{
+    write_finished(out, false);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (queued_.size() >= batches_per_worker * pool_.size()) {
+        batch_done_.wait(lock, [this] { return queued_.front()->done; });
+        lock.unlock();
+        write_finished(out, false);
+        lock.lock();
+    }
+    file_batch *queued = batch.get();
+    queued_.push_back(std::move(batch));
+    lock.unlock();
+    pool_.submit([this, queued](unsigned worker) { hash_batch(*queued, worker); });
+}
+
+bool image_hasher::run(output_sink &out)
+{
+    const ext2_super_block &sb = *layout_.sb;
+    const uint32_t stride = layout_.inode_size();
+    // the reserved inodes below it (bad blocks, resize inode, ...) are no
+    // files even when they map blocks, only the root directory is
+    const uint32_t first_ino = sb.s_rev_level == 0 ? EXT2_GOOD_OLD_FIRST_INO : sb.s_first_ino;
+    std::vector<char> table_scratch;
+    auto batch = std::make_unique<file_batch>();
+    bool tables_ok = true;
+    for (int group = 0; group < layout_.group_count; group++) {
+        int32_t inodes = group_inode_count(sb, group);
+        uint64_t table_pos = (uint64_t)layout_.group_desc(group).bg_inode_table * layout_.block_size;
+        image_.advise(table_pos, (uint64_t)inodes * stride, access_hint::sequential);
+        image_view table = inodes == 0 ? image_view() :
+                           image_.view(table_pos, (uint64_t)(inodes - 1) * stride + sizeof(ext2_inode),
+                                       table_scratch);
+        if (inodes != 0 && !table) {
+            out.flush();
+            std::cerr << "error: could not read the inode table of group " << group << std::endl;
+            tables_ok = false;
+            continue;
+        }
+        for (int32_t i = 0; i < inodes; i++) {
+            uint32_t inode_num = sb.s_inodes_per_group * group + i + 1;
+            if (inode_num < first_ino && inode_num != EXT2_ROOT_INO) { continue; }
+            const ext2_inode &inode = *table.at<ext2_inode>((size_t)i * stride);
+            if (inode.i_mode == 0 || inode.i_links_count == 0 || inode_file_type(inode) != 'f') { continue; }
+            batch->files.push_back({inode_num, inode});
+            batch->bytes += std::max<uint64_t>(inode_file_size(inode), layout_.block_size);
+            if (batch->bytes >= batch_bytes) {
+                submit(std::move(batch), out);
+                batch = std::make_unique<file_batch>();
+            }
+        }
+    }
+    if (!batch->files.empty()) { submit(std::move(batch), out); }
+    write_finished(out, true);
+    out.flush();
+    return tables_ok && ok_;
+}
+
+} // namespace
+
+int hash_files(const std::vector<std::string> &images, file_digest digest, bool use_mmap, bool direct,
+               size_t cache_bytes, unsigned jobs)
+{
+    thread_pool pool(jobs);
+    output_sink out(STDOUT_FILENO);
+    int result = 0;
+    for (const std::string &path : images) {
+        if (images.size() > 1) { out << "IMAGE," << path << "\n"; }
+        ext2_image image;
+        if (!image.open(path.c_str(), use_mmap, direct)) {
+            out.flush();
+            std::cerr << "Could not open file " << path << std::endl;
+            result = 1;
+            continue;
+        }
+        image.advise(access_hint::random);
+        ext2_layout layout;
+        if (!read_superblock(image, layout) || !read_group_descriptors(image, layout)) {
+            out.flush();
+            std::cerr << "error: could not read the superblock and group descriptors of " << path << std::endl;
+            result = 1;
+            continue;
+        }
+        image_hasher hasher(image, layout, digest, cache_bytes, pool);
+        if (!hasher.run(out)) { result = 1; }
+    }
+    out.flush();
+    return result;
+}
@@ -0,0 +1,28 @@
+#ifndef EXT2_HASH_FILES_H
+#define EXT2_HASH_FILES_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum class file_digest
+{
+    xxh64,
+    sha256,
+};
+
+// Prints a FILEHASH record with the digest of the contents of every regular
+// file of `images` (`--hash-files`), to find the same files in different
+// images. Reserved inodes such as the resize inode are skipped. The inode
+// tables are read a group at a time and the files are handed to `jobs`
+// workers in batches of about the same number of bytes, so a batch of
+// thousands of one block files costs as little to queue as one large file. Each file's block map is walked into runs of blocks that are
+// consecutive in the file and on disk, and each run is hashed with one read
+// (or in place, when the image is mapped). Holes hash as zeros.
+// With several images the records of each one are preceded by an
+// `IMAGE,<path>` line. Returns 1 (with a message on stderr) if an image or a
+// file couldn't be read, 0 otherwise.
+int hash_files(const std::vector<std::string> &images, file_digest digest, bool use_mmap, bool direct,
+               size_t cache_bytes, unsigned jobs);
+
+#endif // EXT2_HASH_FILES_H
@@ -0,0 +1,285 @@
+#include "htree.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// The header of the index behind ".." in the first block
+struct dx_root_info
+{
+    __u32 reserved_zero;
+    __u8 hash_version;
+    __u8 info_length;
+    __u8 indirect_levels;
+    __u8 unused_flags;
+};
+
+// Index entries follow a count/limit pair that takes the place of the first
+// entry's hash, so entry 0 has no hash of its own and covers everything below
+// the hash of entry 1
+struct dx_countlimit
+{
+    __u16 limit;
+    __u16 count;
+};
+
+struct dx_entry
+{
+    __u32 hash;
+    __u32 block;
+};
+
+// ".", ".." and the root info
+const uint32_t dx_root_header = 12 + 12 + sizeof(dx_root_info);
+// the unused entry in front of a lower level index block
+const uint32_t dx_node_header = 8;
+// ext2 trees have at most two levels below the root
+const int dx_max_levels = 3;
+
+// Copies the name into the 32 bit words the half MD4 and TEA hashes work on,
+// padded with its length
+template <typename Char>
+void str2hashbuf(const char *msg, int len, uint32_t *buf, int num)
+{
+    uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+    uint32_t val = pad;
+    if (len > num * 4) { len = num * 4; }
+    for (int i = 0; i < len; i++) {
+        val = (int)(Char)msg[i] + (val << 8);
+        if (i % 4 == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0) { *buf++ = val; }
+    while (--num >= 0) { *buf++ = pad; }
+}
+
+template <typename Char>
+uint32_t dx_hack_hash(const char *name, int len)
+{
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    while (len--) {
+        hash = hash1 + (hash0 ^ (uint32_t)((int)(Char)*name++ * 7152373));
+        if (hash & 0x80000000) { hash -= 0x7fffffff; }
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+inline uint32_t rol32(uint32_t x, int s) { return (x << s) | (x >> (32 - s)); }
+
+// Three rounds of MD4 over 8 words
+uint32_t half_md4_transform(uint32_t buf[4], const uint32_t in[8])
+{
+    auto f = [](uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+    auto g = [](uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+    auto h = [](uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+    const uint32_t k2 = 013240474631u, k3 = 015666365641u;
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+#define ROUND(fn, a, b, c, d, x, s) (a += fn(b, c, d) + (x), a = rol32(a, s))
+    ROUND(f, a, b, c, d, in[0], 3);
+    ROUND(f, d, a, b, c, in[1], 7);
+    ROUND(f, c, d, a, b, in[2], 11);
+    ROUND(f, b, c, d, a, in[3], 19);
+    ROUND(f, a, b, c, d, in[4], 3);
+    ROUND(f, d, a, b, c, in[5], 7);
+    ROUND(f, c, d, a, b, in[6], 11);
+    ROUND(f, b, c, d, a, in[7], 19);
+
+    ROUND(g, a, b, c, d, in[1] + k2, 3);
+    ROUND(g, d, a, b, c, in[3] + k2, 5);
+    ROUND(g, c, d, a, b, in[5] + k2, 9);
+    ROUND(g, b, c, d, a, in[7] + k2, 13);
+    ROUND(g, a, b, c, d, in[0] + k2, 3);
+    ROUND(g, d, a, b, c, in[2] + k2, 5);
+    ROUND(g, c, d, a, b, in[4] + k2, 9);
+    ROUND(g, b, c, d, a, in[6] + k2, 13);
+
+    ROUND(h, a, b, c, d, in[3] + k3, 3);
+    ROUND(h, d, a, b, c, in[7] + k3, 9);
+    ROUND(h, c, d, a, b, in[2] + k3, 11);
+    ROUND(h, b, c, d, a, in[6] + k3, 15);
+    ROUND(h, a, b, c, d, in[1] + k3, 3);
+    ROUND(h, d, a, b, c, in[5] + k3, 9);
+    ROUND(h, c, d, a, b, in[0] + k3, 11);
+    ROUND(h, b, c, d, a, in[4] + k3, 15);
+#undef ROUND
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+    return buf[1];
+}
+
+void tea_transform(uint32_t buf[4], const uint32_t in[4])
+{
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+    for (int n = 0; n < 16; n++) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+template <typename Char>
+uint32_t half_md4_hash(const char *name, int len, uint32_t buf[4])
+{
+    uint32_t in[8];
+    for (; len > 0; len -= 32, name += 32) {
+        str2hashbuf<Char>(name, len, in, 8);
+        half_md4_transform(buf, in);
+    }
+    return buf[1];
+}
+
+template <typename Char>
+uint32_t tea_hash(const char *name, int len, uint32_t buf[4])
+{
+    uint32_t in[4];
+    for (; len > 0; len -= 16, name += 16) {
+        str2hashbuf<Char>(name, len, in, 4);
+        tea_transform(buf, in);
+    }
+    return buf[0];
+}
+
+// One index block on the way down to a leaf and the entry that was followed
+struct dx_frame
+{
+    cached_block block;
+    const dx_entry *entries = nullptr;
+    uint32_t count = 0;
+    uint32_t at = 0;
+};
+
+// Reads the entries of an index block whose count/limit pair is at `offset`
+bool read_dx_node(cached_block block, uint32_t offset, dx_frame &frame)
+{
+    const dx_countlimit *countlimit = block->at<dx_countlimit>(offset);
+    if (countlimit == nullptr) { return false; }
+    uint32_t limit = (block->size() - offset) / sizeof(dx_entry);
+    if (countlimit->limit != limit || countlimit->count == 0 || countlimit->count > limit) { return false; }
+    frame.entries = block->at<dx_entry>(offset, (size_t)countlimit->count * sizeof(dx_entry));
+    frame.count = countlimit->count;
+    frame.block = std::move(block);
+    return frame.entries != nullptr;
+}
+
+// The last entry whose hash is at or below `hash`. Entry 0 has no hash and
+// matches everything below entry 1.
+uint32_t dx_search(const dx_frame &frame, uint32_t hash)
+{
+    uint32_t low = 1, high = frame.count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (frame.entries[mid].hash > hash) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low - 1;
+}
+
+} // namespace
+
+bool dx_hash(std::string_view name, int version, const uint32_t seed[4], uint32_t &hash)
+{
+    uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    if (seed[0] != 0 || seed[1] != 0 || seed[2] != 0 || seed[3] != 0) { memcpy(buf, seed, sizeof(buf)); }
+    const char *p = name.data();
+    int len = name.size();
+    switch (version) {
+    case DX_HASH_LEGACY: hash = dx_hack_hash<signed char>(p, len); break;
+    case DX_HASH_LEGACY_UNSIGNED: hash = dx_hack_hash<unsigned char>(p, len); break;
+    case DX_HASH_HALF_MD4: hash = half_md4_hash<signed char>(p, len, buf); break;
+    case DX_HASH_HALF_MD4_UNSIGNED: hash = half_md4_hash<unsigned char>(p, len, buf); break;
+    case DX_HASH_TEA: hash = tea_hash<signed char>(p, len, buf); break;
+    case DX_HASH_TEA_UNSIGNED: hash = tea_hash<unsigned char>(p, len, buf); break;
+    default: return false;
+    }
+    hash &= ~1u;
+    // the largest hash marks the end of a readdir and is never stored
+    if (hash == (0x7fffffffu << 1)) { hash = (0x7fffffffu - 1) << 1; }
+    return true;
+}
+
+bool is_indexed_dir(const ext2_super_block &sb, const ext2_inode &dir)
+{
+    return (sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) && (dir.i_flags & EXT2_INDEX_FL) &&
+           inode_file_type(dir) == 'd';
+}
+
+bool htree_lookup(const ext2_super_block &sb, const ext2_inode &dir, std::string_view name,
+                  block_cache &cache, record_writer &out, uint32_t &inode_num)
+{
+    inode_num = 0;
+    uint32_t block_size = cache.block_size();
+    uint32_t root_block = map_logical_block(dir, 0, cache, out);
+    cached_block root = root_block != 0 ? cache.get(root_block) : cached_block();
+    if (!root) { return false; }
+    const dx_root_info *info = root->at<dx_root_info>(24);
+    if (info == nullptr || info->reserved_zero != 0 || info->info_length != sizeof(dx_root_info) ||
+        info->indirect_levels >= dx_max_levels) {
+        return false;
+    }
+    if (name == "." || name == "..") {
+        // both live in the root block, in front of the index
+        bool ok = for_each_block_entry(*root, 0, block_size, [&](uint64_t, const ext2_dir_entry &entry) {
+            if (entry.name_len == name.size() && memcmp(entry.name, name.data(), name.size()) == 0) {
+                inode_num = entry.inode;
+            }
+        });
+        return ok;
+    }
+    int version = info->hash_version;
+    if (version <= DX_HASH_TEA && (sb.s_flags & EXT2_FLAGS_UNSIGNED_HASH)) { version += DX_HASH_LEGACY_UNSIGNED; }
+    uint32_t hash;
+    if (!dx_hash(name, version, sb.s_hash_seed, hash)) { return false; }
+
+    // Go down from the root, remembering the entry followed at every level
+    int levels = info->indirect_levels + 1;
+    dx_frame frames[dx_max_levels];
+    if (!read_dx_node(root, dx_root_header, frames[0])) { return false; }
+    frames[0].at = dx_search(frames[0], hash);
+    int level = 0;
+    // after a collision the next leaf is reached through the first entries of
+    // the index blocks below the one that moved on
+    bool search = true;
+    while (true) {
+        for (; level + 1 < levels; level++) {
+            const dx_frame &frame = frames[level];
+            uint32_t node = map_logical_block(dir, frame.entries[frame.at].block & 0x0fffffff, cache, out);
+            cached_block block = node != 0 ? cache.get(node) : cached_block();
+            if (!block || !read_dx_node(std::move(block), dx_node_header, frames[level + 1])) { return false; }
+            frames[level + 1].at = search ? dx_search(frames[level + 1], hash) : 0;
+        }
+        // the leaf the name hashes to
+        uint32_t leaf_logical = frames[level].entries[frames[level].at].block & 0x0fffffff;
+        uint32_t leaf = map_logical_block(dir, leaf_logical, cache, out);
+        cached_block block = leaf != 0 ? cache.get(leaf) : cached_block();
+        if (!block) { return false; }
+        bool ok = for_each_block_entry(*block, (uint64_t)leaf_logical * block_size, UINT64_MAX,
+            [&](uint64_t, const ext2_dir_entry &entry) {
+                if (entry.name_len == name.size() && memcmp(entry.name, name.data(), name.size()) == 0) {
+                    inode_num = entry.inode;
+                }
+            });
+        if (!ok) { return false; }
+        if (inode_num != 0) { return true; }
+        // Names whose hashes collide can continue in the next leaf, whose
+        // index entry then has the same hash with the lowest bit set
+        while (level >= 0 && ++frames[level].at >= frames[level].count) { level--; }
+        if (level < 0 || (frames[level].entries[frames[level].at].hash & ~1u) != hash) { return true; }
+        search = false;
+    }
+}
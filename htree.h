@@ -0,0 +1,43 @@
+#ifndef EXT2_HTREE_H
+#define EXT2_HTREE_H
+
+#include <cstdint>
+#include <string_view>
+
+#include "filesystem.h"
+
+// Indexed directories (the dir_index feature). The first block of such a
+// directory holds "." and "..", the second of which spans the rest of the
+// block and hides a tree of (hash, block) entries sorted by the hash of the
+// names. Every other index block is a single unused entry hiding another level
+// of the tree, so a linear walk of the directory still sees every name. A
+// lookup hashes the name and binary searches one index block per level down
+// to the one leaf block that can hold it.
+
+// Hash functions of the index, as stored in dx_root_info.hash_version
+enum dx_hash_version : uint8_t
+{
+    DX_HASH_LEGACY = 0,
+    DX_HASH_HALF_MD4 = 1,
+    DX_HASH_TEA = 2,
+    // the same, computed on the name as unsigned chars (the superblock says which)
+    DX_HASH_LEGACY_UNSIGNED = 3,
+    DX_HASH_HALF_MD4_UNSIGNED = 4,
+    DX_HASH_TEA_UNSIGNED = 5,
+};
+
+// Hash of `name` as the index stores it (the lowest bit is always 0). An all
+// zero `seed` stands for the default one. Returns false for an unknown version.
+bool dx_hash(std::string_view name, int version, const uint32_t seed[4], uint32_t &hash);
+
+// Whether `dir` has an index the filesystem allows to be used
+bool is_indexed_dir(const ext2_super_block &sb, const ext2_inode &dir);
+
+// Looks `name` up in the index of `dir`. Returns false if the index can't be
+// used (it is malformed, or one of its blocks can't be read), in which case the
+// directory has to be searched linearly. Otherwise `inode_num` is the inode of
+// `name`, or 0 if there is no such entry.
+bool htree_lookup(const ext2_super_block &sb, const ext2_inode &dir, std::string_view name,
+                  block_cache &cache, record_writer &out, uint32_t &inode_num);
+
+#endif // EXT2_HTREE_H
@@ -0,0 +1,185 @@
+#include "image.h"
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// O_DIRECT transfers must start at, and be a multiple of, the logical block
+// size of the device. 4096 covers every device we are likely to meet.
+const uint64_t direct_align = 4096;
+// the largest single pread in direct mode
+const size_t direct_max_read = 4 << 20;
+
+// Each thread reads through its own aligned buffer, allocated on first use
+struct bounce_buffer
+{
+    char *data = nullptr;
+    size_t size = 0;
+    ~bounce_buffer() { free(data); }
+
+    bool reserve(size_t len)
+    {
+        if (len <= size) { return true; }
+        void *p = nullptr;
+        if (posix_memalign(&p, direct_align, len) != 0) { return false; }
+        free(data);
+        data = (char *)p;
+        size = len;
+        return true;
+    }
+};
+
+thread_local bounce_buffer bounce;
+
+} // namespace
+
+ext2_image::~ext2_image()
+{
+    if (map_ != nullptr) { munmap((void *)map_, size_); }
+    if (fd_ >= 0) { close(fd_); }
+}
+
+bool ext2_image::open(const char *path, bool allow_mmap, bool direct)
+{
+    direct_ = direct;
+    fd_ = ::open(path, direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+    if (fd_ < 0) { return false; }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) { return false; }
+    if (S_ISREG(st.st_mode)) {
+        regular_ = true;
+        size_ = st.st_size;
+    } else if (S_ISBLK(st.st_mode)) {
+        // block devices report a size of 0, ask the device instead
+        off_t end = lseek(fd_, 0, SEEK_END);
+        size_ = end < 0 ? 0 : end;
+    }
+    if (direct_) { return size_ > 0; }
+    if (allow_mmap && size_ > 0) {
+        void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (addr != MAP_FAILED) {
+            map_ = (const char *)addr;
+            return true;
+        }
+    }
+
+    // fall back to reading the image with std::fstream
+    fh_.open(path, std::ios::in | std::ios::binary);
+    if (!fh_.is_open()) { return false; }
+    if (size_ == 0) {
+        fh_.seekg(0, std::ios::end);
+        size_ = fh_ ? (uint64_t)fh_.tellg() : 0;
+    }
+    return true;
+}
+
+image_view ext2_image::view(uint64_t offset, size_t len)
+{
+    image_view v;
+    if (offset > size_ || size_ - offset < len) { return v; }
+    if (map_ != nullptr) {
+        if (stats_enabled) { global_stats.count_read(offset, len, 0); }
+        v.data_ = map_ + offset;
+        v.size_ = len;
+        return v;
+    }
+    v.owned_.resize(len);
+    if (!read(offset, v.owned_.data(), len)) { return v; }
+    v.data_ = v.owned_.data();
+    v.size_ = len;
+    return v;
+}
+
+image_view ext2_image::view(uint64_t offset, size_t len, std::vector<char> &scratch)
+{
+    if (map_ != nullptr) { return view(offset, len); }
+    image_view v;
+    if (offset > size_ || size_ - offset < len) { return v; }
+    scratch.resize(len);
+    if (!read(offset, scratch.data(), len)) { return v; }
+    v.data_ = scratch.data();
+    v.size_ = len;
+    return v;
+}
+
+bool ext2_image::read(uint64_t offset, void *dst, size_t len)
+{
+    if (offset > size_ || size_ - offset < len) { return false; }
+    if (map_ != nullptr) {
+        if (stats_enabled) { global_stats.count_read(offset, len, 0); }
+        memcpy(dst, map_ + offset, len);
+        return true;
+    }
+    if (direct_) { return read_direct(offset, (char *)dst, len); }
+    // a seek and a read
+    if (stats_enabled) { global_stats.count_read(offset, len, 2); }
+    std::lock_guard<std::mutex> lock(fh_mutex_);
+    fh_.clear();
+    fh_.seekg(offset, std::ios::beg);
+    if (!fh_) { return false; }
+    fh_.read((char *)dst, len);
+    return (bool)fh_;
+}
+
+bool ext2_image::read_direct(uint64_t offset, char *dst, size_t len)
+{
+    while (len > 0) {
+        // widen the range to aligned boundaries and copy the middle out
+        uint64_t start = offset & ~(direct_align - 1);
+        size_t head = offset - start;
+        size_t n = std::min(len, direct_max_read - head);
+        size_t span = (head + n + direct_align - 1) & ~(direct_align - 1);
+        if (!bounce.reserve(span)) { return false; }
+        size_t got = 0;
+        // the last block of an image that isn't a multiple of the alignment
+        // comes back short, which is fine as long as it covers what we need
+        while (got < head + n) {
+            if (stats_enabled) { global_stats.count_read(start + got, span - got, 1); }
+            ssize_t r = pread(fd_, bounce.data + got, span - got, start + got);
+            if (r < 0 && errno == EINTR) { continue; }
+            if (r <= 0) { return false; }
+            got += r;
+        }
+        memcpy(dst, bounce.data + head, n);
+        offset += n;
+        dst += n;
+        len -= n;
+    }
+    return true;
+}
+
+void ext2_image::advise(uint64_t offset, uint64_t len, access_hint hint)
+{
+    if (map_ == nullptr || offset >= size_) { return; }
+    // madvise wants a page aligned start address
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page_size - 1);
+    uint64_t end = offset + len < size_ ? offset + len : size_;
+    int advice = MADV_NORMAL;
+    switch (hint) {
+        case access_hint::normal:     advice = MADV_NORMAL;     break;
+        case access_hint::sequential: advice = MADV_SEQUENTIAL; break;
+        case access_hint::random:     advice = MADV_RANDOM;     break;
+        case access_hint::willneed:   advice = MADV_WILLNEED;   break;
+    }
+    if (stats_enabled) { global_stats.count_syscall(); }
+    madvise((void *)(map_ + start), end - start, advice);
+}
+
+void ext2_image::prefetch(uint64_t offset, uint64_t len)
+{
+    // in direct mode the page cache is exactly what we stay out of
+    if (fd_ < 0 || direct_ || offset >= size_) { return; }
+    if (len > size_ - offset) { len = size_ - offset; }
+    if (stats_enabled) { global_stats.count_syscall(); }
+    posix_fadvise(fd_, offset, len, POSIX_FADV_WILLNEED);
+}
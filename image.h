@@ -0,0 +1,112 @@
+#ifndef EXT2_IMAGE_H
+#define EXT2_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+// A read-only window onto a byte range of the image.
+// When the image is memory mapped the view points straight into the mapping
+// (zero-copy), otherwise it owns a copy that was read with the std::fstream fallback.
+class image_view
+{
+public:
+    image_view() = default;
+    // A view of `size` bytes of memory owned by the caller
+    image_view(const char *data, size_t size) : data_(data), size_(size) {}
+    image_view(image_view &&) = default;
+    image_view &operator=(image_view &&) = default;
+    image_view(const image_view &) = delete;
+    image_view &operator=(const image_view &) = delete;
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+    // Returns a pointer to a T that starts `off` bytes into the view, or nullptr
+    // if the `len` bytes needed to look at it do not fit inside the view.
+    // `len` defaults to the full size of T, records such as `ext2_dir_entry`
+    // pass the number of bytes they actually occupy.
+    template <typename T>
+    const T *at(size_t off, size_t len = sizeof(T)) const
+    {
+        if (data_ == nullptr || off > size_ || size_ - off < len) { return nullptr; }
+        return reinterpret_cast<const T *>(data_ + off);
+    }
+
+private:
+    friend class ext2_image;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<char> owned_;
+};
+
+// madvise() hints for the different phases of a scan
+enum class access_hint
+{
+    normal,
+    sequential, // bitmaps and inode tables are read front to back
+    random,     // indirect and directory blocks are scattered over the disk
+    willneed,   // a range we are about to read
+};
+
+// Read-only access to an ext2 image.
+// The image is memory mapped when possible. Inputs that cannot be mapped
+// (e.g. character devices, or when mmap fails) fall back to std::fstream.
+// In direct mode the image is opened with O_DIRECT and read with pread through
+// an aligned bounce buffer, so a scan of a large device doesn't go through
+// (and evict everything else from) the page cache.
+class ext2_image
+{
+public:
+    ext2_image() = default;
+    ~ext2_image();
+    ext2_image(const ext2_image &) = delete;
+    ext2_image &operator=(const ext2_image &) = delete;
+
+    // Open `path`. When `allow_mmap` is false the std::fstream path is always used,
+    // `direct` opens it with O_DIRECT and never maps it.
+    bool open(const char *path, bool allow_mmap = true, bool direct = false);
+    bool is_mapped() const { return map_ != nullptr; }
+    bool is_direct() const { return direct_; }
+    uint64_t size() const { return size_; }
+    // The descriptor of the opened image, e.g. for copy_file_range
+    int fd() const { return fd_; }
+    // true when the image is a plain file rather than a device
+    bool is_regular_file() const { return regular_; }
+
+    // Returns a view of `len` bytes starting at byte `offset` of the image.
+    // The view is empty if the range does not lie entirely inside the image.
+    image_view view(uint64_t offset, size_t len);
+    // The same, but without a mapping the bytes are read into `scratch`, whose
+    // capacity is reused from call to call. The view borrows `scratch` and is
+    // only valid until `scratch` is changed.
+    image_view view(uint64_t offset, size_t len, std::vector<char> &scratch);
+    // Copies `len` bytes starting at byte `offset` into `dst`
+    bool read(uint64_t offset, void *dst, size_t len);
+
+    // Hint how a byte range (or the whole image) is about to be accessed.
+    // This is a no-op unless the image is mapped.
+    void advise(uint64_t offset, uint64_t len, access_hint hint);
+    void advise(access_hint hint) { advise(0, size_, hint); }
+    // Starts reading a byte range into the page cache in the background
+    // (posix_fadvise WILLNEED). Works for mapped and unmapped images alike,
+    // but is a no-op in direct mode.
+    void prefetch(uint64_t offset, uint64_t len);
+
+private:
+    bool read_direct(uint64_t offset, char *dst, size_t len);
+
+    int fd_ = -1;
+    const char *map_ = nullptr;
+    uint64_t size_ = 0;
+    bool regular_ = false;
+    bool direct_ = false;
+    std::fstream fh_;
+    // the std::fstream fallback can only serve one reader at a time
+    std::mutex fh_mutex_;
+};
+
+#endif // EXT2_IMAGE_H
@@ -0,0 +1,174 @@
+#include "layout_report.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+// How many indirect blocks ext2 allocates right before data block `logical`
+// (with `per_block` pointers per indirect block): the first data block under
+// each new indirect block follows that block, and those under a new double or
+// triple indirect block follow it too. A data block that far past the last one
+// still continues its fragment.
+uint32_t indirect_blocks_before(uint64_t logical, uint64_t per_block)
+{
+    if (logical < EXT2_NDIR_BLOCKS) { return 0; }
+    logical -= EXT2_NDIR_BLOCKS;
+    if (logical < per_block) { return logical == 0 ? 1 : 0; }
+    logical -= per_block;
+    if (logical < per_block * per_block) { return logical == 0 ? 2 : logical % per_block == 0 ? 1 : 0; }
+    logical -= per_block * per_block;
+    return logical == 0 ? 3 : logical % (per_block * per_block) == 0 ? 2 : logical % per_block == 0 ? 1 : 0;
+}
+
+// The histogram bucket of a fragment count
+int fragment_bucket(uint32_t fragments)
+{
+    int bucket = 0;
+    while (bucket + 1 < layout_report::buckets && fragments > (1u << bucket)) { bucket++; }
+    return bucket;
+}
+
+// Totals of a block group or of the whole filesystem
+struct layout_totals
+{
+    uint64_t inodes = 0;
+    uint64_t data_blocks = 0;
+    uint64_t fragments = 0;
+    uint64_t meta_blocks = 0;
+    uint64_t histogram[layout_report::buckets] = {};
+
+    void add(const layout_report::inode_layout &inode)
+    {
+        inodes++;
+        data_blocks += inode.data_blocks;
+        fragments += inode.fragments;
+        meta_blocks += inode.meta_blocks;
+        histogram[fragment_bucket(inode.fragments)]++;
+    }
+    void add(const layout_totals &other)
+    {
+        inodes += other.inodes;
+        data_blocks += other.data_blocks;
+        fragments += other.fragments;
+        meta_blocks += other.meta_blocks;
+        for (int i = 0; i < layout_report::buckets; i++) { histogram[i] += other.histogram[i]; }
+    }
+    void print(std::ostream &report) const
+    {
+        report << inodes << "," << data_blocks << "," << fragments << "," << meta_blocks;
+        for (uint64_t count : histogram) { report << "," << count; }
+        report << "\n";
+    }
+};
+
+} // namespace
+
+layout_report::layout_report(const ext2_layout &layout)
+    : inodes_per_group_(layout.sb->s_inodes_per_group), block_size_(layout.block_size), groups_(layout.group_count)
+{
+}
+
+void layout_report::add_inode(const inode_layout &inode)
+{
+    uint32_t group = (inode.inode_num - 1) / inodes_per_group_;
+    if (group < groups_.size()) { groups_[group].push_back(inode); }
+}
+
+void layout_report::finish(std::ostream &report) const
+{
+    report << std::fixed << std::setprecision(3);
+    for (const auto &group : groups_) {
+        for (const inode_layout &inode : group) {
+            double seek = inode.data_blocks > 1 ? (double)inode.seek_blocks / (inode.data_blocks - 1) : 0;
+            report << "LAYOUT_INODE," << inode.inode_num << "," << inode.type << "," << inode.data_blocks << ","
+                   << inode.fragments << "," << inode.longest_run << "," << seek << "," << inode.meta_blocks
+                   << "\n";
+        }
+    }
+    layout_totals filesystem;
+    for (size_t g = 0; g < groups_.size(); g++) {
+        layout_totals totals;
+        for (const inode_layout &inode : groups_[g]) { totals.add(inode); }
+        report << "LAYOUT_GROUP," << g << ",";
+        totals.print(report);
+        filesystem.add(totals);
+    }
+    report << "LAYOUT_FS,";
+    filesystem.print(report);
+    report.flush();
+}
+
+void layout_writer::inode(uint32_t inode_num, const ext2_inode &inode)
+{
+    end_inode();
+    char type = inode_file_type(inode);
+    // the same inodes the scan walks the block maps of
+    if (type == 'f' || type == 'd') {
+        current_.inode_num = inode_num;
+        current_.type = type;
+        if (!extents_) {
+            for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+                if (inode.i_block[i] != 0) { add_run(i, inode.i_block[i], 1); }
+            }
+            for (int i = EXT2_IND_BLOCK; i < EXT2_N_BLOCKS; i++) {
+                if (inode.i_block[i] != 0) { current_.meta_blocks++; }
+            }
+        }
+    }
+    out_.inode(inode_num, inode);
+}
+
+void layout_writer::indirect(uint32_t inode_num, int level, uint32_t logical_offset, uint32_t ind_block,
+                             uint32_t block)
+{
+    if (inode_num == current_.inode_num) {
+        // a level 1 pointer is a data block, the others are indirect blocks
+        if (level == 1) {
+            add_run(logical_offset, block, 1);
+        } else {
+            current_.meta_blocks++;
+        }
+    }
+    out_.indirect(inode_num, level, logical_offset, ind_block, block);
+}
+
+void layout_writer::extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start, uint32_t length)
+{
+    if (inode_num == current_.inode_num) { add_run(logical_start, physical_start, length); }
+    out_.extent(inode_num, logical_start, physical_start, length);
+}
+
+void layout_writer::meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length)
+{
+    if (inode_num == current_.inode_num) { current_.meta_blocks += length; }
+    out_.meta_extent(inode_num, physical_start, length);
+}
+
+void layout_writer::add_run(uint32_t logical, uint32_t block, uint32_t length)
+{
+    if (current_.data_blocks == 0) {
+        current_.fragments = 1;
+        run_length_ = length;
+    } else {
+        uint32_t skipped = indirect_blocks_before(logical, report_.block_size() / sizeof(__u32));
+        uint32_t next = last_block_ + 1;
+        if (block == next || block == next + skipped) {
+            run_length_ += length;
+        } else {
+            current_.fragments++;
+            current_.seek_blocks += block > next ? block - next : next - block;
+            run_length_ = length;
+        }
+    }
+    current_.data_blocks += length;
+    current_.longest_run = std::max(current_.longest_run, run_length_);
+    last_block_ = block + length - 1;
+}
+
+void layout_writer::end_inode()
+{
+    if (current_.inode_num != 0 && current_.data_blocks != 0) { report_.add_inode(current_); }
+    current_ = {};
+    run_length_ = 0;
+}
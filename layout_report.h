@@ -0,0 +1,105 @@
+#ifndef EXT2_LAYOUT_REPORT_H
+#define EXT2_LAYOUT_REPORT_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "filesystem.h"
+#include "records.h"
+
+// `--layout-report`: how the files and directories are laid out on disk,
+// made from the block map records of the scan itself. For every inode: its
+// data blocks, the fragments they form, the longest of them, the average
+// distance between consecutive data blocks and its indirect blocks. Then
+// histograms of the fragment counts per block group and for the whole
+// filesystem. A block map is followed one record at a time, so an inode's
+// metrics take the same few counters however large the file is.
+class layout_report
+{
+public:
+    // the fragment count histogram buckets: 1, 2, 3-4, 5-8, ..., more than 64
+    static const int buckets = 8;
+
+    // what the report keeps of one inode
+    struct inode_layout
+    {
+        uint32_t inode_num;
+        char type;
+        uint32_t data_blocks;
+        uint32_t fragments;
+        uint32_t longest_run;
+        uint32_t meta_blocks;
+        // sum of the distances between consecutive data blocks that don't follow each other
+        uint64_t seek_blocks;
+    };
+
+    explicit layout_report(const ext2_layout &layout);
+
+    // Inodes are added by the writer of their own group's scan, and groups are
+    // scanned by one thread each, so this needs no lock
+    void add_inode(const inode_layout &inode);
+
+    // Prints the LAYOUT_INODE, LAYOUT_GROUP and LAYOUT_FS lines described in the README
+    void finish(std::ostream &report) const;
+
+    uint32_t block_size() const { return block_size_; }
+
+private:
+    uint32_t inodes_per_group_;
+    uint32_t block_size_;
+    std::vector<std::vector<inode_layout>> groups_;
+};
+
+// Forwards every record to `out` and follows the block maps of the INODE and
+// INDIRECT (or with `extents` EXTENT and META_EXTENT) records into a
+// `layout_report`. The records of an inode all come before the next INODE
+// record, so one inode is followed at a time.
+class layout_writer : public record_writer
+{
+public:
+    layout_writer(layout_report &report, record_writer &out, bool extents)
+        : report_(report), out_(out), extents_(extents) {}
+    ~layout_writer() override { end_inode(); }
+
+    void superblock(const ext2_super_block &sb, uint32_t block_size) override { out_.superblock(sb, block_size); }
+    void group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+               const ext2_group_desc &bgd) override
+    {
+        out_.group(group, blocks_in_group, inodes_in_group, bgd);
+    }
+    void bfree(uint32_t block) override { out_.bfree(block); }
+    void ifree(uint32_t inode) override { out_.ifree(inode); }
+    void bfree_range(uint32_t first, uint32_t count) override { out_.bfree_range(first, count); }
+    void ifree_range(uint32_t first, uint32_t count) override { out_.ifree_range(first, count); }
+    void inode(uint32_t inode_num, const ext2_inode &inode) override;
+    void dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry) override
+    {
+        out_.dirent(parent, offset, entry);
+    }
+    void indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                  uint32_t ind_block, uint32_t block) override;
+    void extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                uint32_t length) override;
+    void meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length) override;
+    void message(std::string_view line) override { out_.message(line); }
+
+    void append(record_writer &other) override { out_.append(other); }
+    void flush() override { out_.flush(); }
+
+private:
+    // `length` data blocks from `logical` and `block` on
+    void add_run(uint32_t logical, uint32_t block, uint32_t length);
+    // hands the inode being followed to the report
+    void end_inode();
+
+    layout_report &report_;
+    record_writer &out_;
+    bool extents_;
+    // the inode being followed, `current_.inode_num` is 0 if there is none
+    layout_report::inode_layout current_ = {};
+    uint32_t run_length_ = 0;
+    uint32_t last_block_ = 0;
+};
+
+#endif // EXT2_LAYOUT_REPORT_H
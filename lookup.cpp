@@ -0,0 +1,116 @@
+#include "lookup.h"
+
+#include "htree.h"
+
+#include <memory>
+#include <unistd.h>
+
+path_resolver::path_resolver(ext2_image &image, const ext2_layout &layout, block_cache &cache)
+    : image_(image), layout_(layout), cache_(cache)
+{
+}
+
+const path_resolver::dir_index *path_resolver::directory(uint32_t dir, record_writer &out)
+{
+    auto found = dirs_.find(dir);
+    if (found != dirs_.end()) { return &found->second; }
+    ext2_inode inode;
+    if (!read_inode(image_, layout_, dir, inode)) {
+        out.message("error: could not read inode " + std::to_string(dir) + "\n");
+        return nullptr;
+    }
+    if (inode_file_type(inode) != 'd') { return nullptr; }
+    dir_index entries;
+    bool ok = for_each_dir_entry(inode, cache_, out, [&entries](uint64_t, const ext2_dir_entry &entry) {
+        entries.emplace(std::string(entry.name, entry.name_len), entry.inode);
+    });
+    if (!ok) { return nullptr; }
+    return &dirs_.emplace(dir, std::move(entries)).first->second;
+}
+
+bool path_resolver::indexed(uint32_t dir, std::string_view name, record_writer &out, uint32_t &inode_num)
+{
+    // directories already searched linearly are answered from their map
+    if (dirs_.count(dir) != 0) { return false; }
+    ext2_inode inode;
+    if (!read_inode(image_, layout_, dir, inode) || !is_indexed_dir(*layout_.sb, inode)) { return false; }
+    return htree_lookup(*layout_.sb, inode, name, cache_, out, inode_num);
+}
+
+uint32_t path_resolver::resolve(std::string_view path, record_writer &out)
+{
+    uint32_t inode = EXT2_ROOT_INO;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t end = path.find('/', pos);
+        if (end == std::string_view::npos) { end = path.size(); }
+        std::string_view name = path.substr(pos, end - pos);
+        pos = end + 1;
+        // "a//b" and a trailing "/" have empty components
+        if (name.empty()) { continue; }
+        // Indexed directories only have the blocks on the way to the name read
+        uint32_t found_inode;
+        if (indexed(inode, name, out, found_inode)) {
+            if (found_inode == 0) { return 0; }
+            inode = found_inode;
+            continue;
+        }
+        const dir_index *entries = directory(inode, out);
+        if (entries == nullptr) { return 0; }
+        auto found = entries->find(std::string(name));
+        if (found == entries->end()) { return 0; }
+        inode = found->second;
+    }
+    return inode;
+}
+
+int lookup_paths(const char *in_file, const std::vector<std::string> &paths, block_map_records block_map,
+                 bool use_mmap, bool direct, size_t cache_bytes, record_format format)
+{
+    // errors go through the writer too, in order with the records
+    std::unique_ptr<record_writer> writer = make_record_writer(format, STDOUT_FILENO);
+    record_writer &out = *writer;
+    ext2_image image;
+    if (!image.open(in_file, use_mmap, direct)) {
+        out.message("Could not open file\n");
+        out.flush();
+        return 1;
+    }
+    // only a few scattered blocks are read
+    image.advise(access_hint::random);
+    ext2_layout layout;
+    if (!read_superblock(image, layout)) {
+        out.message("error: could not read superblock\n");
+        out.flush();
+        return 1;
+    }
+    if (!read_group_descriptors(image, layout)) {
+        out.message("error: could not read block group descriptor table\n");
+        out.flush();
+        return 1;
+    }
+    block_cache cache(image, layout.block_size, cache_bytes);
+    path_resolver resolver(image, layout, cache);
+    int result = 0;
+    for (const std::string &path : paths) {
+        uint32_t inode_num = resolver.resolve(path, out);
+        ext2_inode inode;
+        if (inode_num == 0 || !read_inode(image, layout, inode_num, inode)) {
+            out.message("error: " + path + ": no such file or directory\n");
+            result = 1;
+            continue;
+        }
+        out.inode(inode_num, inode);
+        char file_type = inode_file_type(inode);
+        if (file_type != 'd' && file_type != 'f') { continue; }
+        bool ok = true;
+        if (block_map == block_map_records::indirect) {
+            ok = print_all_indirect_blocks(inode, inode_num - 1, cache, out);
+        } else if (block_map == block_map_records::extents) {
+            ok = print_extents(inode, inode_num - 1, cache, out);
+        }
+        if (!ok) { result = 1; }
+    }
+    out.flush();
+    return result;
+}
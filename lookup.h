@@ -0,0 +1,56 @@
+#ifndef EXT2_LOOKUP_H
+#define EXT2_LOOKUP_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "filesystem.h"
+#include "records.h"
+
+// Resolves paths to inode numbers by walking the directories from the root
+// inode, reading only the directories along the path. Indexed (htree)
+// directories are searched through their index, which reads one block per
+// level of the tree. The entries of every other directory that is searched are
+// kept in a hash map, so later lookups through the same directories don't read
+// them again.
+class path_resolver
+{
+public:
+    path_resolver(ext2_image &image, const ext2_layout &layout, block_cache &cache);
+
+    // Returns the inode number of the absolute `path`, or 0 if it doesn't
+    // exist. Symbolic links are not followed. Read errors are reported through `out`.
+    uint32_t resolve(std::string_view path, record_writer &out);
+
+private:
+    using dir_index = std::unordered_map<std::string, uint32_t>;
+
+    // The name -> inode map of directory `dir`, or nullptr if `dir` is not a directory
+    const dir_index *directory(uint32_t dir, record_writer &out);
+    // Looks `name` up through the htree index of `dir`. Returns false if `dir`
+    // has no usable index and has to be read with `directory` instead.
+    bool indexed(uint32_t dir, std::string_view name, record_writer &out, uint32_t &inode_num);
+
+    ext2_image &image_;
+    const ext2_layout &layout_;
+    block_cache &cache_;
+    std::unordered_map<uint32_t, dir_index> dirs_;
+};
+
+// Which records describe the blocks of a looked up inode
+enum class block_map_records
+{
+    none,
+    indirect,
+    extents,
+};
+
+// Prints the INODE record (followed by the `block_map` records) of every path in `paths`. Returns 1 if the image can't be read or a path
+// doesn't exist, 0 otherwise.
+int lookup_paths(const char *in_file, const std::vector<std::string> &paths, block_map_records block_map,
+                 bool use_mmap, bool direct, size_t cache_bytes, record_format format);
+
+#endif // EXT2_LOOKUP_H
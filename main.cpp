@@ -1,506 +1,932 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
-#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "ext2_fs.h"
+#include "image.h"
+#include "block_cache.h"
+#include "bitmap.h"
+#include "thread_pool.h"
+#include "records.h"
+#include "binary_format.h"
+#include "snapshot_index.h"
+#include "hash.h"
+#include "filesystem.h"
+#include "lookup.h"
+#include "extract.h"
+#include "prefetch.h"
+#include "stats.h"
+#include "audit.h"
+#include "layout_report.h"
+#include "stream.h"
+#include "diff.h"
+#include "serve.h"
+#include "hash_files.h"
 
-#define BYTES_PRE_SUPER_BLOCK 1024
-u_int block_size;
-// The amount of bytes that can be stored in the direct block (i.e. first 12)
-u_int size_of_direct_blocks;
-// the amout of bytes that can be stored in the single indirect block (i.e. block 13)
-u_int size_of_single_indirect;
-// the amout of bytes that can be stored in the double indirect block (i.e. block 14)
-u_int size_of_double_indirect;
-// the amout of bytes that can be stored in the triple indirect block (i.e. block 15)
-u_int size_of_triple_indirect;
-
-bool check_istream_state(std::istream *fh)
+// The inode table is read this many bytes at a time
+const uint32_t inode_chunk_bytes = 1 << 20;
+
+// Options that change how `read_ext2_image` accesses the image
+struct scan_options
 {
-    if (!*fh)
+    bool use_mmap = true;
+    // O_DIRECT reads through aligned buffers, bypassing the page cache
+    bool direct = false;
+    // memory budget of the indirect/directory block cache
+    size_t cache_bytes = 64 << 20;
+    // print the block cache hit/miss counts to stderr
+    bool cache_stats = false;
+    // report free blocks/inodes as BFREE_RANGE/IFREE_RANGE runs instead of one record each
+    bool free_ranges = false;
+    // read each group's directory and indirect blocks ahead, in disk order
+    bool prefetch = false;
+    // report block maps as EXTENT/META_EXTENT runs instead of INDIRECT records
+    bool extents = false;
+    // number of block groups scanned at the same time
+    unsigned jobs = 1;
+    // how the records are encoded
+    record_format format = record_format::csv;
+    // snapshot index used for incremental rescans, or nullptr
+    const char *index_path = nullptr;
+    // paths printed by `--lookup` instead of scanning the whole image
+    std::vector<std::string> lookups;
+    // also print the INDIRECT (or with `extents` EXTENT) records of the looked up inodes
+    bool lookup_indirect = false;
+    // `--extract TARGET DEST` copies the file TARGET (inode number or path) to DEST
+    const char *extract_target = nullptr;
+    const char *extract_dest = nullptr;
+    // `--stats` reports counters and phase timings to stderr, `--stats=FILE` as JSON to FILE
+    bool stats = false;
+    const char *stats_path = nullptr;
+    // `--audit` checks the bitmaps, free counts and link counts against what the inodes refer to
+    bool audit = false;
+    // `--layout-report` reports the fragmentation of every file and directory
+    // to stderr, `--layout-report=FILE` to FILE
+    bool layout_report = false;
+    const char *layout_report_path = nullptr;
+    // read the image strictly front to back (`-` for stdin, or `--stream`)
+    bool stream = false;
+    // `--records`: the record kinds (`record_kind` bits) to print. The parts of
+    // the image only the others are made from are not read.
+    uint32_t records = record_all;
+    // `--groups`: the block groups to scan, `--inodes`: the inodes whose
+    // IFREE, INODE, DIRENT and INDIRECT records are printed (both inclusive)
+    uint32_t first_group = 0;
+    uint32_t last_group = UINT32_MAX;
+    uint32_t first_inode = 1;
+    uint32_t last_inode = UINT32_MAX;
+
+    bool filtered() const
     {
-        // std::cout << "error: only " << fh.gcount() << " could be read" << std::endl;
-        std::cout << "eof "  << fh->eof()  << std::endl;
-        std::cout << "fail " << fh->fail() << std::endl;
-        std::cout << "bad "  << fh->bad()  << std::endl;
-        return true;
+        return records != record_all || first_group != 0 || last_group != UINT32_MAX || first_inode != 1 ||
+               last_inode != UINT32_MAX;
     }
-    return false;
-}
- 
-// Function to convert decimal number to octal
-int decimal_to_octal(int decimalNumber)
+};
+
+// Prints the GROUP, BFREE, IFREE, INODE, DIRENT and INDIRECT records of one block group.
+// Groups don't depend on each other, so several can be scanned at once as long as
+// each has its own `cache`, `arena` and `out`. Only the records `options` selects
+// are printed, and only what they are made from is read.
+bool scan_group(ext2_image& image, block_cache& cache, scan_arena& arena, const ext2_layout& layout,
+                int group, const scan_options& options, record_writer& out)
 {
-    int rem, i = 1, octalNumber = 0;
-    while (decimalNumber != 0)
-    {
-        rem = decimalNumber % 8;
-        decimalNumber /= 8;
-        octalNumber += rem * i;
-        i *= 10;
+    const ext2_super_block &sb = *layout.sb;
+    const ext2_group_desc &bgd = layout.group_desc(group);
+    const uint32_t block_size = layout.block_size;
+    int32_t blocks_in_group = group_block_count(sb, group);
+    int32_t inodes_in_group = group_inode_count(sb, group);
+    // bit i of the block bitmap is block first_block + i, bit i of the inode
+    // bitmap (and entry i of the inode table) is inode first_inode + i + 1
+    uint32_t first_block = group_first_block(sb, group);
+    uint32_t first_inode = sb.s_inodes_per_group * group;
+    const uint32_t records = options.records;
+    if (records & record_group) { out.group(group, blocks_in_group, inodes_in_group, bgd); }
+    // the entries [inode_lo, inode_hi) of the inode bitmap and table are the
+    // inodes `--inodes` asks for
+    int32_t inode_lo = std::min<uint64_t>(std::max(options.first_inode - 1, first_inode) - first_inode,
+                                          inodes_in_group);
+    int32_t inode_hi = options.last_inode <= first_inode ? 0 :
+                       std::min<uint64_t>(options.last_inode - first_inode, inodes_in_group);
+    inode_hi = std::max(inode_lo, inode_hi);
+
+    // read the block bitmap
+    phase_timer bitmaps_timer(stat_phase::bitmaps);
+    if (records & record_bfree) {
+        uint64_t block_bitmap_pos = (uint64_t)bgd.bg_block_bitmap * block_size;
+        image.advise(block_bitmap_pos, block_size, access_hint::willneed);
+        image_view block_bitmap = image.view(block_bitmap_pos, (blocks_in_group + 7) / 8);
+        if (!block_bitmap) {
+            out.message("error: could not read data into block bitmap\n");
+            return false;
+        }
+        print_free_blocks(block_bitmap.data(), blocks_in_group, first_block, options.free_ranges, out);
+    }
+    // read the inode bitmap
+    if ((records & record_ifree) && inode_lo < inode_hi) {
+        uint64_t inode_bitmap_pos = (uint64_t)bgd.bg_inode_bitmap * block_size + inode_lo / 64 * 8;
+        image.advise(inode_bitmap_pos, block_size, access_hint::willneed);
+        image_view inode_bitmap = image.view(inode_bitmap_pos, (inode_hi - inode_lo / 64 * 64 + 7) / 8);
+        if (!inode_bitmap) {
+            out.message("error: could not read data into inode bitmap\n");
+            return false;
+        }
+        print_free_inodes(inode_bitmap.data(), inode_hi - inode_lo / 64 * 64, first_inode + inode_lo / 64 * 64,
+                          options.free_ranges, out, inode_lo % 64);
     }
-    return octalNumber;
-}
 
+    // READ the INODE TABLE
+    phase_timer inode_table_timer(stat_phase::inode_table);
+    if (!(records & (record_inode | record_dirent | record_indirect)) || inode_lo == inode_hi) { return true; }
+    // entries are s_inode_size bytes apart, only the first 128 bytes of each are decoded
+    uint32_t stride = inode_size(sb);
+    uint64_t inode_table_pos = (uint64_t)bgd.bg_inode_table * block_size;
+    uint64_t wanted_pos = inode_table_pos + (uint64_t)inode_lo * stride;
+    image.advise(wanted_pos, (uint64_t)(inode_hi - inode_lo) * stride, access_hint::sequential);
+    if (options.prefetch && (records & (record_dirent | record_indirect))) {
+        prefetch_group_blocks(image, block_size, wanted_pos, inode_hi - inode_lo, stride,
+                              records & record_dirent, records & record_indirect);
+    }
+    // The table is read a large chunk at a time into the arena (or viewed in
+    // place when the image is mapped) instead of one inode at a time
+    const int32_t chunk_inodes = std::max<int32_t>(1, inode_chunk_bytes / stride);
+    for (int32_t first = inode_lo; first < inode_hi; first += chunk_inodes) {
+        int32_t count = std::min(chunk_inodes, inode_hi - first);
+        uint64_t chunk_pos = inode_table_pos + (uint64_t)first * stride;
+        // a table that runs past the end of the image is read up to its last whole inode
+        int32_t readable = 0;
+        if (chunk_pos <= image.size() && image.size() - chunk_pos >= sizeof(ext2_inode)) {
+            readable = std::min<uint64_t>(count, (image.size() - chunk_pos - sizeof(ext2_inode)) / stride + 1);
+        }
+        image_view chunk;
+        if (readable > 0) {
+            chunk = image.view(chunk_pos, (uint64_t)(readable - 1) * stride + sizeof(ext2_inode), arena.inode_table);
+            if (!chunk) { readable = 0; }
+        }
+        for (int32_t k = 0; k < count; k++) {
+            int32_t i = first + k;
+            // zero based inode number, counted across all groups
+            int32_t inode_index = first_inode + i;
+            if (k >= readable) {
+                out.message("error: could not read data into inode table " + std::to_string(i) + " \n");
+                return false;
+            }
+            const ext2_inode &inode_table = *chunk.at<ext2_inode>((size_t)k * stride);
+            char file_type = inode_file_type(inode_table);
+            if (inode_table.i_mode !=0 && inode_table.i_links_count != 0) {
+                if (records & record_inode) { out.inode(inode_index + 1, inode_table); }
+
+                if (file_type == 'd' && (records & record_dirent)) {
+                    phase_timer timer(stat_phase::directories);
+                    if (!print_directory_entries(inode_table, inode_index, cache, out)) return false;
+                }
 
-std::string convert_unix_epoch_to_date(time_t unix_epoch)
+                // INDIRECT BLOCKS
+                if ((file_type == 'd' || file_type == 'f') && (records & record_indirect)) {
+                    // only inodes that have indirect blocks are timed, timing every
+                    // small file would cost more than walking its direct blocks
+                    bool has_indirect = inode_table.i_block[EXT2_IND_BLOCK] != 0 ||
+                                        inode_table.i_block[EXT2_DIND_BLOCK] != 0 ||
+                                        inode_table.i_block[EXT2_TIND_BLOCK] != 0;
+                    phase_timer timer(has_indirect ? stat_phase::indirect : stat_phase::inode_table);
+                    if (options.extents) {
+                        if (!print_extents(inode_table, inode_index, cache, out)) { return false; }
+                    } else if (!print_all_indirect_blocks(inode_table, inode_index, cache, out)) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Hash of everything `scan_group` reads from the group's own metadata: the group
+// descriptor, both bitmaps and the inode table
+uint64_t hash_group(ext2_image& image, const ext2_layout& layout, int group)
 {
-    struct tm *timeinfo;
-    char buffer[80];
- 
-    timeinfo = gmtime(&unix_epoch);
- 
-    strftime(buffer, 80, "%D %T", timeinfo);
-    return std::string(buffer);
+    const ext2_group_desc &bgd = layout.group_desc(group);
+    const uint64_t block_size = layout.block_size;
+    xxh64_state hash;
+    hash.update(&bgd, sizeof(bgd));
+    uint64_t inodes_in_group = group_inode_count(*layout.sb, group);
+    const uint64_t ranges[3][2] = {
+        {bgd.bg_block_bitmap * block_size, block_size},
+        {bgd.bg_inode_bitmap * block_size, block_size},
+        {bgd.bg_inode_table * block_size, inodes_in_group * layout.inode_size()},
+    };
+    for (const auto &range : ranges) {
+        image_view data = image.view(range[0], range[1]);
+        if (!data) {
+            // can't be compared, make sure the group is scanned again
+            hash.update(&range, sizeof(range));
+            continue;
+        }
+        hash.update(data.data(), data.size());
+    }
+    return hash.digest();
 }
 
-void print_superblock(ext2_super_block sb)
+// Identifies the filesystem layout and the options that change the records, an
+// index written with a different fingerprint can't be reused
+uint64_t scan_fingerprint(const ext2_super_block& sb, const scan_options& options)
 {
-    std::cout << "SUPERBLOCK," <<
-                sb.s_blocks_count << "," <<
-                sb.s_inodes_count << "," <<
-                block_size << "," <<
-                sb.s_inode_size << "," <<
-                sb.s_blocks_per_group << "," <<
-                sb.s_inodes_per_group << "," <<
-                sb.s_first_ino << std::endl;
+    // the first field is bumped whenever the bin chunk layout or the records of
+    // an unchanged group change
+    const uint32_t fields[] = {5, sb.s_blocks_count, sb.s_inodes_count, sb.s_log_block_size,
+                               sb.s_blocks_per_group, sb.s_inodes_per_group, sb.s_first_ino,
+                               sb.s_inode_size, options.free_ranges, options.extents, options.records,
+                               options.first_group, options.last_group, options.first_inode,
+                               options.last_inode};
+    return xxh64(fields, sizeof(fields));
 }
 
-std::optional<__u32> get_indirect_block(uint ind_block, uint ind_offset, std::fstream& fh)
+// Produces the records of one group. With a snapshot index, a group whose
+// metadata hash didn't change since the index was written has its saved
+// records replayed instead of being scanned. With an `audit` or a `report`
+// the records, scanned or replayed, also go through them on their way to `out`.
+bool process_group(ext2_image& image, block_cache& cache, scan_arena& arena, const ext2_layout& layout,
+                   int group, const scan_options& options, snapshot_index* index, fs_audit* audit,
+                   layout_report* report, record_writer& out)
 {
-    int position = ind_block * block_size + ind_offset;
-    fh.seekg(position, std::ios::beg);
-    if (check_istream_state(&fh)) {
-        printf("error: could not seek to indirect block\n");
-        return {};
+    group_timer timer(group);
+    std::optional<layout_writer> followed;
+    if (report != nullptr) { followed.emplace(*report, out, options.extents); }
+    record_writer &followed_out = followed ? *followed : out;
+    std::optional<audit_writer> audited;
+    if (audit != nullptr) { audited.emplace(*audit, followed_out, options.extents); }
+    record_writer &dest = audited ? *audited : followed_out;
+    if (index == nullptr) {
+        return scan_group(image, cache, arena, layout, group, options, dest);
     }
-    __u32 block_number;
-    fh.read((char *)&block_number, sizeof(__u32));
-    if (check_istream_state(&fh)) {
-        printf("error: could not read indirect block\n");
-        return {};
+    uint64_t hash = hash_group(image, layout, group);
+    std::string_view saved;
+    if (index->find(group, hash, saved)) {
+        return replay_bin_chunks(saved.data(), saved.size(), dest);
     }
-    return block_number;
-
+    bin_writer records;
+    bool ok = scan_group(image, cache, arena, layout, group, options, records);
+    std::string chunk = records.take_chunk();
+    ok = replay_bin_chunks(chunk.data(), chunk.size(), dest) && ok;
+    if (ok) {
+        index->store(group, hash, std::move(chunk));
+    }
+    return ok;
 }
 
-bool print_indirect_blocks(uint ind_block_num, int32_t inode, int logical_offset,
-                           std::fstream& fh)
+void print_cache_stats(const scan_options& options, uint64_t hits, uint64_t misses, std::ostream& report)
 {
-    // Read the indirect block
-    uint curr_offset = 0;
-    while (true) {
-        auto block_number  = get_indirect_block(ind_block_num, curr_offset, fh);
-        // handle the case where get indirect block returned nothing
-        if (!block_number.has_value()) {
-            printf("Failed on getting data block from single indirect block\n");
-            return false;
-        }
-        if (*block_number != 0) {
-            std::cout << "INDIRECT," <<
-                    (inode + 1) << "," << // I-node number of the owning file (decimal)
-                        1 << "," <<// (decimal) level of indirection for the block being scanned ... 1 for single indirect, 2 for double indirect, 3 for triple
-                        logical_offset + curr_offset / sizeof(__u32) << "," <<// logical block offset (decimal) represented by the referenced block. If the referenced block is a data block, this is the logical block offset of that block within the file. If the referenced block is a single- or double-indirect block, this is the same as the logical offset of the first data block to which it refers.
-                        ind_block_num << "," <<// block number of the (1, 2, 3) indirect block being scanned (decimal) . . . not the highest level block (in the recursive scan), but the lower level block that contains the block reference reported by this entry.
-                        *block_number << std::endl; // block number of the referenced block (decimal)
-        }
-        curr_offset += sizeof(__u32);
-        if (curr_offset >= block_size) { break; }
+    if (options.cache_stats) {
+        report << "block cache: " << hits << " hits, " << misses << " misses" << std::endl;
     }
-    return true;
 }
 
-bool print_2nd_indirect_blocks(uint ind_block_num, int32_t inode, int logical_offset,
-                               std::fstream& fh)
-{
-    // Read the indirect block
-    uint curr_offset = 0;
-    while (true) {
-        auto block_number  = get_indirect_block(ind_block_num, curr_offset, fh);
-        // handle the case where get indirect block returned nothing
-        if (!block_number.has_value()) {
-            printf("Failed on getting single indirect block from double indirect block\n");
-            return false;
-        }
-        if (*block_number != 0) {
-            std::cout << "INDIRECT," <<
-                        (inode + 1) << "," << // I-node number of the owning file (decimal)
-                        2 << "," <<// (decimal) level of indirection for the block being scanned ... 1 for single indirect, 2 for double indirect, 3 for triple
-                        logical_offset + curr_offset / sizeof(__u32) << "," <<// logical block offset (decimal) represented by the referenced block. If the referenced block is a data block, this is the logical block offset of that block within the file. If the referenced block is a single- or double-indirect block, this is the same as the logical offset of the first data block to which it refers.
-                        ind_block_num << "," <<// block number of the (1, 2, 3) indirect block being scanned (decimal) . . . not the highest level block (in the recursive scan), but the lower level block that contains the block reference reported by this entry.
-                        *block_number << std::endl; // block number of the referenced block (decimal)
-            print_indirect_blocks(*block_number, inode, logical_offset + (curr_offset / sizeof(__u32)), fh);
+// Scans `in_file` and writes its records to `out`. The groups are scanned on
+// `pool` when one is given (several images can share it, see `scan_batch`),
+// otherwise on a pool of `options.jobs` workers of its own, or serially with
+// one job. The audit report, the cache statistics and the layout report
+// (unless it has a file of its own) go to `report`.
+// Returns 1 on failure, 2 if the audit found problems and 0 otherwise.
+int read_ext2_image(const char *in_file, const scan_options& options, record_writer& out,
+                    thread_pool* pool = nullptr, std::ostream& report = std::cerr) {
+    uint64_t start_wall = stats_enabled ? wall_clock_ns() : 0;
+    ext2_image image;
+    if (!image.open(in_file, options.use_mmap, options.direct))
+    {
+        report << "Could not open file" << std::endl;
+        return 1;
+    }
+    // Metadata is scattered across the image, so don't let the kernel read ahead
+    // by default. Each group's bitmaps and inode table get their own hints below.
+    image.advise(access_hint::random);
+    ext2_layout layout;
+    {
+        phase_timer timer(stat_phase::superblock);
+        if (!read_superblock(image, layout)) {
+            out.message("error: could not read superblock\n");
+            out.flush();
+            return 1;
         }
-        curr_offset += sizeof(__u32);
-        if (curr_offset >= block_size) { break; }
     }
-    return true;
-}
+    const ext2_super_block &sb = *layout.sb;
+    int block_group_count = layout.group_count;
+    // We will write the contents of the superblock to a .csv file
+    if (options.records & record_superblock) { out.superblock(sb, layout.block_size); }
 
-bool print_3rd_indirect_blocks(uint ind_block_num, int32_t inode, int logical_offset,
-                               std::fstream& fh)
-{
-    // Read the indirect block
-    uint curr_offset = 0;
-    while (true) {
-        auto block_number  = get_indirect_block(ind_block_num, curr_offset, fh);
-        // handle the case where get indirect block returned nothing
-        if (!block_number.has_value()) {
-            printf("Failed on getting double indirect block from triple indirect block\n");
-            return false;
-        }
-        if (*block_number != 0) {
-            std::cout << "INDIRECT," <<
-                        (inode + 1) << "," << // I-node number of the owning file (decimal)
-                        3 << "," <<// (decimal) level of indirection for the block being scanned ... 1 for single indirect, 2 for double indirect, 3 for triple
-                        logical_offset + curr_offset / sizeof(__u32) << "," <<// logical block offset (decimal) represented by the referenced block. If the referenced block is a data block, this is the logical block offset of that block within the file. If the referenced block is a single- or double-indirect block, this is the same as the logical offset of the first data block to which it refers.
-                        ind_block_num << "," <<// block number of the (1, 2, 3) indirect block being scanned (decimal) . . . not the highest level block (in the recursive scan), but the lower level block that contains the block reference reported by this entry.
-                        *block_number << std::endl; // block number of the referenced block (decimal)
-            print_2nd_indirect_blocks(*block_number, inode, logical_offset + (curr_offset / sizeof(__u32)), fh);
+    // The groups to scan: those `--groups` selects, less the ones that would
+    // print nothing because only inode records are wanted and none of their
+    // inodes is. Without any group records the descriptors aren't read either.
+    std::vector<int> groups;
+    bool inode_records_only = !(options.records & (record_group | record_bfree));
+    for (uint64_t g = options.first_group; g <= options.last_group && g < (uint64_t)block_group_count; g++) {
+        uint64_t first_inode = (uint64_t)sb.s_inodes_per_group * g + 1;
+        bool has_inodes = first_inode <= options.last_inode &&
+                          first_inode + group_inode_count(sb, g) > options.first_inode;
+        if ((options.records & ~record_superblock) && (!inode_records_only || has_inodes)) { groups.push_back(g); }
+    }
+    if (!groups.empty()) {
+        phase_timer timer(stat_phase::group_descriptors);
+        if (!read_group_descriptors(image, layout)) {
+            out.message("error: could not read block group descriptor table\n");
+            out.flush();
+            return 1;
         }
-        curr_offset += sizeof(__u32);
-        if (curr_offset >= block_size) { break; }
     }
-    return true;
-}
+    if (stats_enabled) { global_stats.set_group_count(block_group_count); }
+    std::unique_ptr<fs_audit> audit;
+    // an audit that can't be sized from the superblock has found a problem already
+    bool bad_geometry = options.audit && !audit_geometry_ok(layout, image.size(), report);
+    if (options.audit && !bad_geometry) { audit = std::make_unique<fs_audit>(layout); }
+    std::unique_ptr<layout_report> layouts;
+    if (options.layout_report) { layouts = std::make_unique<layout_report>(layout); }
 
-bool get_all_indirect_blocks(uint ind_block_num, std::vector<__u32>& out_vec, std::fstream& fh)
-{
-    // Read the indirect block
-    uint curr_offset = 0;
-    while (curr_offset < block_size) {
-        auto block_number  = get_indirect_block(ind_block_num, curr_offset, fh);
-        // handle the case where get indirect block returned nothing
-        if (!block_number.has_value()) {
-            printf("Failed on getting data block from indirect block\n");
-            return false;
+    snapshot_index index_storage;
+    snapshot_index *index = nullptr;
+    if (options.index_path != nullptr) {
+        index = &index_storage;
+        index->load(options.index_path, scan_fingerprint(sb, options), block_group_count);
+    }
+    // Writes out what is left, reports the statistics and the audit and saves
+    // the snapshot index
+    auto finish = [&](int result, uint64_t hits, uint64_t misses) {
+        out.flush();
+        // an audit of an incomplete scan would report everything it missed
+        if (audit && result == 0 && audit->finish(image, report) != 0) { result = 2; }
+        if (bad_geometry && result == 0) { result = 2; }
+        if (layouts && result != 1) {
+            if (options.layout_report_path == nullptr) {
+                layouts->finish(report);
+            } else {
+                std::ofstream file(options.layout_report_path);
+                layouts->finish(file);
+                if (!file) {
+                    std::cerr << "error: could not write layout report " << options.layout_report_path << std::endl;
+                }
+            }
         }
-        if (*block_number != 0){
-            out_vec.push_back(*block_number);
+        print_cache_stats(options, hits, misses, report);
+        if (stats_enabled) {
+            global_stats.set_cache(hits, misses);
+            global_stats.set_total(wall_clock_ns() - start_wall, process_cpu_ns());
+            if (options.stats_path == nullptr) {
+                global_stats.report(std::cerr);
+            } else if (!global_stats.write_json(options.stats_path)) {
+                std::cerr << "error: could not write stats " << options.stats_path << std::endl;
+            }
         }
-        curr_offset += sizeof(__u32);
-    }
-    return true;
-}
-
-bool get_all_double_indirect_blocks(uint ind_block_num, std::vector<__u32>& out_vec, std::fstream& fh)
-{
-    // Read the indirect block
-    uint curr_offset = 0;
-    while (curr_offset < block_size) {
-        auto block_number  = get_indirect_block(ind_block_num, curr_offset, fh);
-        // handle the case where get indirect block returned nothing
-        if (!block_number.has_value()) {
-            printf("Failed on getting data block from double indirect block\n");
-            return false;
+        if (index != nullptr) {
+            std::cerr << "index: " << index->reused() << " of " << groups.size()
+                      << " groups unchanged" << std::endl;
+            if (!index->save(options.index_path)) {
+                std::cerr << "error: could not write index " << options.index_path << std::endl;
+            }
         }
-        if (*block_number != 0){
-            get_all_indirect_blocks(*block_number, out_vec, fh);
+        return result;
+    };
+
+    if (pool == nullptr && options.jobs <= 1) {
+        block_cache cache(image, layout.block_size, options.cache_bytes);
+        scan_arena arena;
+        for (int i : groups)
+        {
+            if (!process_group(image, cache, arena, layout, i, options, index, audit.get(), layouts.get(), out)) {
+                return finish(1, cache.hits(), cache.misses());
+            }
         }
-        curr_offset += sizeof(__u32);
+        return finish(0, cache.hits(), cache.misses());
     }
-    return true;
-}
 
-bool get_all_triple_indirect_blocks(uint ind_block_num, std::vector<__u32>& out_vec, std::fstream& fh)
-{
-    // Read the indirect block
-    uint curr_offset = 0;
-    while (curr_offset < block_size) {
-        auto block_number  = get_indirect_block(ind_block_num, curr_offset, fh);
-        // handle the case where get indirect block returned nothing
-        if (!block_number.has_value()) {
-            printf("Failed on getting data block from double indirect block\n");
-            return false;
-        }
-        if (*block_number != 0){
-            get_all_double_indirect_blocks(*block_number, out_vec, fh);
+    // Scan the groups on a thread pool. Every group is printed into its own
+    // buffer by one of the workers and the buffers are written out in group
+    // order, so the output is identical to the serial scan above.
+    std::optional<thread_pool> own_pool;
+    if (pool == nullptr) { pool = &own_pool.emplace(options.jobs); }
+    unsigned workers = pool->size();
+    struct group_output
+    {
+        std::unique_ptr<record_writer> records;
+        bool ok = false;
+        bool done = false;
+    };
+    std::vector<group_output> outputs(groups.size());
+    std::mutex outputs_mutex;
+    // buffers that have been written out, kept for reuse by the next groups
+    std::vector<std::unique_ptr<record_writer>> spare_writers;
+    std::condition_variable group_done;
+    // groups whose task has finished, a shared pool can't be waited on for
+    // just this image's tasks
+    int groups_done = 0;
+    std::vector<std::unique_ptr<block_cache>> caches;
+    for (unsigned w = 0; w < workers; w++) {
+        caches.push_back(std::make_unique<block_cache>(image, layout.block_size, options.cache_bytes / workers));
+    }
+    std::vector<scan_arena> arenas(workers);
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        pool->submit([&, i](unsigned worker) {
+            std::unique_ptr<record_writer> group_out;
+            {
+                std::lock_guard<std::mutex> lock(outputs_mutex);
+                if (!spare_writers.empty()) {
+                    group_out = std::move(spare_writers.back());
+                    spare_writers.pop_back();
+                }
+            }
+            if (!group_out) { group_out = make_record_writer(options.format); }
+            bool ok = process_group(image, *caches[worker], arenas[worker], layout, groups[i], options, index,
+                                    audit.get(), layouts.get(), *group_out);
+            std::lock_guard<std::mutex> lock(outputs_mutex);
+            outputs[i].records = std::move(group_out);
+            outputs[i].ok = ok;
+            outputs[i].done = true;
+            groups_done++;
+            group_done.notify_all();
+        });
+    }
+    int result = 0;
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+        std::unique_lock<std::mutex> lock(outputs_mutex);
+        group_done.wait(lock, [&] { return outputs[i].done; });
+        std::unique_ptr<record_writer> group_out = std::move(outputs[i].records);
+        bool ok = outputs[i].ok;
+        lock.unlock();
+        out.append(*group_out);
+        lock.lock();
+        spare_writers.push_back(std::move(group_out));
+        lock.unlock();
+        if (!ok) {
+            // the serial scan stops at the first group that fails
+            result = 1;
+            break;
         }
-        curr_offset += sizeof(__u32);
     }
-    return true;
+    {
+        std::unique_lock<std::mutex> lock(outputs_mutex);
+        group_done.wait(lock, [&] { return groups_done == (int)groups.size(); });
+    }
+    uint64_t hits = 0, misses = 0;
+    for (auto &cache : caches) {
+        hits += cache->hits();
+        misses += cache->misses();
+    }
+    return finish(result, hits, misses);
 }
 
-bool print_directory_entries(ext2_inode inode_table, int inode_num, std::fstream& fh)
+// The tagged stream of a batch without `--output-dir`: every image's records
+// go to one shared writer, each run of them preceded by an "IMAGE,<path>"
+// message line whenever the image changes. The records are buffered here and
+// handed over one block group at a time, so images scanned at the same time
+// interleave by group and no image is held in memory as a whole.
+class tagged_writer : public record_writer
 {
-    // READ the DIRECTORY ENTRIES
-    // For each directory I-node, scan every data block.
-    // For each non-zero data block, print directory information
-    /* We will start by getting all of the data blocks*/
-    std::vector<__u32> data_blocks;
-    for (int i=0; i < EXT2_NDIR_BLOCKS; i++) {
-        data_blocks.push_back(inode_table.i_block[i]);
+public:
+    struct stream
+    {
+        explicit stream(record_writer &out) : out(out) {}
+
+        record_writer &out;
+        std::mutex mutex;
+        // the image the last records handed over belong to
+        const tagged_writer *last = nullptr;
+    };
+
+    tagged_writer(stream &shared, const std::string &path, record_format format)
+        : shared_(shared), tag_("IMAGE," + path + "\n"), buffer_(make_record_writer(format)) {}
+
+    void superblock(const ext2_super_block &sb, uint32_t block_size) override { buffer_->superblock(sb, block_size); }
+    void group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+               const ext2_group_desc &bgd) override
+    {
+        buffer_->group(group, blocks_in_group, inodes_in_group, bgd);
+    }
+    void bfree(uint32_t block) override { buffer_->bfree(block); }
+    void ifree(uint32_t inode) override { buffer_->ifree(inode); }
+    void bfree_range(uint32_t first, uint32_t count) override { buffer_->bfree_range(first, count); }
+    void ifree_range(uint32_t first, uint32_t count) override { buffer_->ifree_range(first, count); }
+    void inode(uint32_t inode_num, const ext2_inode &inode) override { buffer_->inode(inode_num, inode); }
+    void dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry) override
+    {
+        buffer_->dirent(parent, offset, entry);
     }
-    if (inode_table.i_block[EXT2_IND_BLOCK] != 0){
-        if (!get_all_indirect_blocks(inode_table.i_block[EXT2_IND_BLOCK], data_blocks, fh)) return false;
+    void indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                  uint32_t ind_block, uint32_t block) override
+    {
+        buffer_->indirect(inode_num, level, logical_offset, ind_block, block);
     }
-    if (inode_table.i_block[EXT2_DIND_BLOCK] != 0){
-        if (!get_all_indirect_blocks(inode_table.i_block[EXT2_DIND_BLOCK], data_blocks, fh)) return false;
+    void extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                uint32_t length) override
+    {
+        buffer_->extent(inode_num, logical_start, physical_start, length);
     }
-    if (inode_table.i_block[EXT2_TIND_BLOCK] != 0){
-        if (!get_all_indirect_blocks(inode_table.i_block[EXT2_TIND_BLOCK], data_blocks, fh)) return false;
+    void meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length) override
+    {
+        buffer_->meta_extent(inode_num, physical_start, length);
     }
+    void message(std::string_view line) override { buffer_->message(line); }
 
-    uint curr_offset = 0;
-    while (curr_offset < inode_table.i_size)
+    void append(record_writer &other) override
     {
-        // First, we will go to the first data block for the directory
-        int block_list_index = curr_offset / block_size; 
-        // The first 12 data blocks are direct blocks
-        int start_pos = data_blocks.at(block_list_index) * block_size + (curr_offset % block_size);
-        fh.seekg(start_pos, std::ios::beg);
-        if (check_istream_state(&fh)) {
-            printf("error: could not seek to directory data block\n");
-            return false;
-        }
-        // Now, we will read the data block
-        ext2_dir_entry dir_entry;
-        fh.read((char *)&dir_entry, sizeof(ext2_dir_entry));
-        if (check_istream_state(&fh)) {
-            printf("error: could not read data into directory data block\n");
-            return false;
+        buffer_->append(other);
+        hand_over();
+    }
+    void flush() override
+    {
+        hand_over();
+        std::lock_guard<std::mutex> lock(shared_.mutex);
+        shared_.out.flush();
+    }
+
+private:
+    void hand_over()
+    {
+        std::lock_guard<std::mutex> lock(shared_.mutex);
+        if (shared_.last != this) {
+            shared_.out.message(tag_);
+            shared_.last = this;
         }
-        if (dir_entry.inode != 0) {
-            std::cout << "DIRENT," <<
-                        (inode_num + 1) << "," << // parent inode number (decimal) ... the I-node number of the directory that contains this entry
-                        curr_offset << "," << // logical byte offset (decimal) of this entry within the directory
-                        dir_entry.inode << "," << // inode number of the referenced file (decimal)
-                        dir_entry.rec_len << "," << // entry length (decimal)
-                        // I am not sure why name_len has to be cast to an int to work.
-                        (int) dir_entry.name_len << ","; // name length (decimal)
-            // name (string, surrounded by single-quotes). Don't worry about escaping, we promise there will be no single-quotes or commas in any of the file names.
-            std::cout << "'";
-            for (int ii=0; ii < (int) dir_entry.name_len; ii++) {
-                std::cout << dir_entry.name[ii];
+        shared_.out.append(*buffer_);
+    }
+
+    stream &shared_;
+    std::string tag_;
+    std::unique_ptr<record_writer> buffer_;
+};
+
+// Where `scan_batch` writes the records of `image`: `dir`/<file name without
+// .img>.csv (or .bin)
+std::string batch_output_path(const std::string& dir, const std::string& image, record_format format)
+{
+    std::string name = image.substr(image.find_last_of('/') + 1);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".img") == 0) { name.resize(name.size() - 4); }
+    return dir + "/" + name + (format == record_format::bin ? ".bin" : ".csv");
+}
+
+// Scans every image of `images` on one shared pool of `options.jobs` workers.
+// A few driver threads each open an image, queue all of its groups on the pool
+// and write the records out in order, then move on to the next image. The pool
+// runs the queued groups in order whichever image they belong to, so a large
+// image spreads over every worker and the small ones fill in around it.
+// With `output_dir` each image gets its own file, otherwise the records go to
+// stdout as a tagged stream. Returns the worst result of any image.
+int scan_batch(const std::vector<std::string>& images, const scan_options& options, const char* output_dir)
+{
+    thread_pool pool(options.jobs);
+    // twice as many images in flight as workers, so that opening the next
+    // image and writing out the last one overlap with the scanning
+    unsigned drivers = std::min<size_t>(images.size(), 2 * pool.size());
+    scan_options image_options = options;
+    image_options.cache_bytes = options.cache_bytes / drivers;
+    std::unique_ptr<record_writer> stdout_writer = make_record_writer(options.format, STDOUT_FILENO);
+    tagged_writer::stream tagged(*stdout_writer);
+    std::mutex report_mutex;
+    std::atomic<size_t> next_image{0};
+    std::atomic<int> worst{0};
+
+    auto drive = [&] {
+        for (size_t i; (i = next_image++) < images.size();) {
+            const std::string &path = images[i];
+            std::ostringstream report;
+            int result = 1;
+            if (output_dir != nullptr) {
+                std::string out_path = batch_output_path(output_dir, path, options.format);
+                int fd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    report << "error: could not create " << out_path << std::endl;
+                } else {
+                    {
+                        std::unique_ptr<record_writer> out = make_record_writer(options.format, fd);
+                        result = read_ext2_image(path.c_str(), image_options, *out, &pool, report);
+                    }
+                    close(fd);
+                }
+            } else {
+                tagged_writer out(tagged, path, options.format);
+                result = read_ext2_image(path.c_str(), image_options, out, &pool, report);
             }
-            std::cout << "'" << std::endl;
+            // 1 (failed) is worse than 2 (audit problems)
+            int seen = worst.load();
+            while ((result == 1 || (result == 2 && seen == 0)) && !worst.compare_exchange_weak(seen, result)) {}
+            std::string text = report.str();
+            if (!text.empty() || result == 1) {
+                std::lock_guard<std::mutex> lock(report_mutex);
+                std::cerr << path << ":" << (result == 1 ? " scan failed" : "") << "\n" << text << std::flush;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned d = 0; d < drivers; d++) { threads.emplace_back(drive); }
+    for (auto &thread : threads) { thread.join(); }
+    stdout_writer->flush();
+    return worst;
+}
+
+// Whether `path` names a .img file or a device such as /dev/sdb1
+bool is_image_path(const std::string &path)
+{
+    struct stat st;
+    bool is_device = stat(path.c_str(), &st) == 0 && (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode));
+    return is_device || (path.size() >= 4 && path.substr(path.size() - 4) == ".img");
+}
+
+// Parses `--groups`/`--inodes` ranges: "A-B", "A-" (A to the end) or "A" (just A)
+bool parse_range(const std::string& text, uint32_t& first, uint32_t& last)
+{
+    char *end;
+    const char *p = text.c_str();
+    if (!isdigit((unsigned char)*p)) { return false; }
+    unsigned long a = strtoul(p, &end, 10);
+    unsigned long b = a;
+    if (*end == '-') {
+        p = end + 1;
+        b = UINT32_MAX;
+        if (*p != '\0') {
+            if (!isdigit((unsigned char)*p)) { return false; }
+            b = strtoul(p, &end, 10);
+        } else {
+            end = (char *)p;
         }
-        curr_offset += dir_entry.rec_len;
     }
+    if (*end != '\0' || a > b || b > UINT32_MAX) { return false; }
+    first = a;
+    last = b;
     return true;
 }
 
-int read_ext2_image(const char *in_file) {
-    std::fstream fh;
-    fh.open(in_file, std::ios::in | std::ios::binary);
-    if (!fh.is_open())
-    {
-        std::cerr << "Could not open file" << std::endl;
-        return 1;
+// main method should take one command line argument, 
+// the path to the image file, optionally preceded by options
+//   --no-mmap          read the image with std::fstream instead of memory mapping it
+//   --cache-size=MB    memory budget of the indirect/directory block cache
+//   --cache-stats      print the block cache hit/miss counts to stderr
+//   --free-ranges      print BFREE_RANGE/IFREE_RANGE runs instead of BFREE/IFREE records
+//   --stats[=FILE]     report I/O counters and per-phase/per-group timings to stderr,
+//                      or as JSON to FILE
+//   --prefetch         read each group's directory and indirect blocks ahead, sorted by
+//                      disk offset, before they are parsed
+//   -j N               scan N block groups in parallel, the output is the same as with -j 1
+//   --format=csv|bin   write CSV records (default) or the binary columnar format
+//   --index=FILE       only re-parse the groups that changed since FILE was written,
+//                      the others are replayed from FILE (which is then updated)
+//   --lookup PATH      only print the INODE record of PATH (may be given more than once)
+//   --indirect         with --lookup, also print the inode's INDIRECT records
+//   --extract TARGET DEST  copy the regular file TARGET (inode number or path) out of
+//                      the image to DEST, keeping its holes
+//   --extents          print EXTENT/META_EXTENT runs instead of INDIRECT records
+//   --stream           read the image front to back, as `-` (stdin) and FIFOs always are
+//   --audit            report blocks and inodes whose bitmap bits, owners or link
+//                      counts are inconsistent to stderr, exit status 2 if there are any
+//   --layout-report[=FILE]  also report the fragments, longest run, average seek distance and
+//                      indirect blocks of every file, with per group and filesystem histograms
+//   --batch FILE       also scan the images listed in FILE (one per line), several
+//                      image arguments may be given as well; all of them share the -j pool
+//   --output-dir DIR   with several images, write each one's records to DIR/<name>.csv
+//                      (or .bin) instead of a tagged stream on stdout
+//   --records=LIST     only print these record kinds (comma separated, e.g. INODE,DIRENT)
+//   --groups A-B       only scan block groups A to B
+//   --inodes A-B       only print the IFREE, INODE, DIRENT and INDIRECT records of inodes A to B
+//   --diff OLD NEW     instead of scanning an image, print what changed from the image OLD
+//                      to the image NEW (another snapshot of the same filesystem)
+//   --serve SOCKET     keep the images open and answer STAT, LOOKUP, BLOCKS and LS
+//                      requests on the Unix socket SOCKET until interrupted
+//   --hash-files[=xxh64|sha256]  instead of the records, print the digest of the contents of
+//                      every regular file (XXH64 by default)
+
+int run(int argc, char *argv[]) {
+    scan_options options;
+    const char *batch_path = nullptr;
+    const char *output_dir = nullptr;
+    const char *diff_old = nullptr;
+    const char *diff_new = nullptr;
+    const char *serve_path = nullptr;
+    bool hashing = false;
+    file_digest digest = file_digest::xxh64;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0'; argi++) {
+        std::string arg = argv[argi];
+        if (arg == "-j" && argi + 1 < argc) {
+            uint64_t jobs;
+            if (!parse_number(argv[++argi], UINT32_MAX, jobs)) {
+                printf("error: bad count %s for -j\n", argv[argi]);
+                return 1;
+            }
+            options.jobs = jobs;
+            if (options.jobs == 0) { options.jobs = std::thread::hardware_concurrency(); }
+        } else if (arg == "--no-mmap") {
+            options.use_mmap = false;
+        } else if (arg == "--direct") {
+            options.direct = true;
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            uint64_t megabytes;
+            if (!parse_number(argv[argi] + strlen("--cache-size="), SIZE_MAX >> 20, megabytes)) {
+                printf("error: bad size in %s\n", arg.c_str());
+                return 1;
+            }
+            options.cache_bytes = megabytes << 20;
+        } else if (arg == "--cache-stats") {
+            options.cache_stats = true;
+        } else if (arg == "--format=csv") {
+            options.format = record_format::csv;
+        } else if (arg == "--format=bin") {
+            options.format = record_format::bin;
+        } else if (arg.rfind("--index=", 0) == 0) {
+            options.index_path = argv[argi] + strlen("--index=");
+        } else if (arg == "--lookup" && argi + 1 < argc) {
+            options.lookups.push_back(argv[++argi]);
+        } else if (arg == "--extract" && argi + 2 < argc) {
+            options.extract_target = argv[++argi];
+            options.extract_dest = argv[++argi];
+        } else if (arg == "--indirect") {
+            options.lookup_indirect = true;
+        } else if (arg == "--stats") {
+            options.stats = true;
+        } else if (arg.rfind("--stats=", 0) == 0) {
+            options.stats = true;
+            options.stats_path = argv[argi] + strlen("--stats=");
+        } else if (arg == "--prefetch") {
+            options.prefetch = true;
+        } else if (arg == "--extents") {
+            options.extents = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--audit") {
+            options.audit = true;
+        } else if (arg == "--layout-report") {
+            options.layout_report = true;
+        } else if (arg.rfind("--layout-report=", 0) == 0) {
+            options.layout_report = true;
+            options.layout_report_path = argv[argi] + strlen("--layout-report=");
+        } else if (arg == "--batch" && argi + 1 < argc) {
+            batch_path = argv[++argi];
+        } else if (arg == "--diff" && argi + 2 < argc) {
+            diff_old = argv[++argi];
+            diff_new = argv[++argi];
+        } else if (arg == "--serve" && argi + 1 < argc) {
+            serve_path = argv[++argi];
+        } else if (arg == "--hash-files" || arg == "--hash-files=xxh64") {
+            hashing = true;
+        } else if (arg == "--hash-files=sha256") {
+            hashing = true;
+            digest = file_digest::sha256;
+        } else if (arg == "--output-dir" && argi + 1 < argc) {
+            output_dir = argv[++argi];
+        } else if (arg == "--free-ranges") {
+            options.free_ranges = true;
+        } else if (arg.rfind("--records=", 0) == 0) {
+            if (!parse_record_kinds(arg.substr(strlen("--records=")), options.records) || options.records == 0) {
+                printf("error: unknown record kind in %s\n", arg.c_str());
+                return 1;
+            }
+        } else if ((arg == "--groups" || arg == "--inodes") && argi + 1 < argc) {
+            bool ok = arg == "--groups" ? parse_range(argv[++argi], options.first_group, options.last_group)
+                                        : parse_range(argv[++argi], options.first_inode, options.last_inode);
+            if (!ok || (arg == "--inodes" && options.first_inode == 0)) {
+                printf("error: bad range %s for %s\n", argv[argi], arg.c_str());
+                return 1;
+            }
+        } else {
+            printf("error: unknown option %s\n", arg.c_str());
+            return 1;
+        }
     }
-    // An Ext2 file systems starts with a superblock located at byte offset 1024 from the start of the volume.
-    ext2_super_block sb;
-    fh.seekg(1024);                                     // move 1024 bytes from the start of the file
-    fh.read((char *)&sb, sizeof(sb)); // read the data into the superblock
-    check_istream_state(&fh);
-    // We will write the contents of the superblock to a .csv file
-    block_size = 1024 << sb.s_log_block_size;
-    size_of_direct_blocks = block_size * 12;
-    int block_ids_stored_in_one_block = block_size / sizeof(__u32); // __u32 is the datatype that block numbers are stored in
-    size_of_single_indirect = block_size * block_ids_stored_in_one_block;
-    size_of_double_indirect = size_of_single_indirect * block_ids_stored_in_one_block;
-    size_of_triple_indirect = size_of_double_indirect * block_ids_stored_in_one_block;
-    print_superblock(sb);
-
-    // Depending on how many block groups are defined, the Block Group Descriptor
-    // table can require multiple blocks of storage.
-    int block_group_count = (sb.s_blocks_count + sb.s_blocks_per_group - 1) / sb.s_blocks_per_group;
-    // int blocks_for_block_group_descriptor = (sizeof(ext2_group_desc) * block_group_count) / block_size;
-    for (int i = 0; i < block_group_count; i++)
-    {
-        int pos = BYTES_PRE_SUPER_BLOCK + sizeof(sb) + (i * sizeof(ext2_group_desc));
-        fh.seekg(pos, std::ios::beg); // move 2048 bytes from the start of the file
-        if (check_istream_state(&fh)) {
-            printf("error: could not seek to block group descriptor table\n");
+    std::vector<std::string> images(argv + argi, argv + argc);
+    if (diff_old != nullptr) {
+        if (!images.empty() || batch_path != nullptr || options.format != record_format::csv) {
+            printf("error: --diff takes no other images and only writes CSV\n");
             return 1;
         }
-        ext2_group_desc bgd;
-        fh.read((char *)&bgd, sizeof(bgd));
-        if (check_istream_state(&fh)) {
-            printf("error: could not read data into block group\n");
+        return diff_images(diff_old, diff_new, options.use_mmap, options.direct, options.cache_bytes, options.jobs);
+    }
+    if (serve_path != nullptr && !images.empty()) {
+        if (batch_path != nullptr || options.format != record_format::csv) {
+            printf("error: --serve takes its images as arguments and only writes CSV\n");
             return 1;
         }
-        int32_t blocks_in_group = sb.s_blocks_count - (sb.s_blocks_per_group  * i);
-        if (blocks_in_group < 0) {
-            printf("error: blocks_in_group < 0\n");
+        return serve_images(serve_path, images, options.use_mmap, options.direct, options.cache_bytes,
+                            options.extents);
+    }
+    if (batch_path != nullptr) {
+        std::ifstream list(batch_path);
+        if (!list) {
+            printf("error: could not read %s\n", batch_path);
             return 1;
         }
-        int32_t inodes_in_group = sb.s_inodes_count - (sb.s_inodes_per_group  * i);
-        if (inodes_in_group < 0) {
-            printf("error: inodes_in_group < 0\n");
+        // blank lines and lines starting with # are skipped
+        for (std::string line; std::getline(list, line);) {
+            if (!line.empty() && line[0] != '#') { images.push_back(line); }
+        }
+    }
+    if (images.empty()) {
+        printf("usage: %s [--no-mmap] [--direct] [--cache-size=MB] [--cache-stats] [--stats[=FILE]] [--prefetch] [--free-ranges] [--extents] [--audit] [--layout-report[=FILE]] [--stream] [-j N] [--format=csv|bin] [--index=FILE] [--records=LIST] [--groups A-B] [--inodes A-B] [--lookup PATH [--indirect]] [--extract TARGET DEST] <image file | ->\n"
+               "       %s [--no-mmap] [--direct] [--cache-size=MB] [-j N] --diff OLD NEW\n"
+               "       %s [--no-mmap] [--direct] [--cache-size=MB] [--extents] --serve SOCKET <image file>...\n"
+               "       %s [--no-mmap] [--direct] [--cache-size=MB] [-j N] [--batch FILE] --hash-files[=xxh64|sha256] <image file>...\n"
+               "       %s [options] [--batch FILE] [--output-dir DIR] <image file>...\n",
+               argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (hashing) {
+        if (options.format != record_format::csv) {
+            printf("error: --hash-files only writes CSV\n");
             return 1;
         }
-        std::cout << "GROUP," << 
-            i << "," <<                                           // group number
-            blocks_in_group << "," <<                             // total number of blocks in this group
-            inodes_in_group << "," <<                             // total number of i-nodes in this group
-            bgd.bg_free_blocks_count << "," << // number of free blocks
-            bgd.bg_free_inodes_count << "," << // number of free i-nodes
-            bgd.bg_block_bitmap << "," <<      // block number of free block bitmap for this group
-            bgd.bg_inode_bitmap << "," <<      // block number of free i-node bitmap for this group
-            bgd.bg_inode_table << std::endl;   // block number of first block of i-nodes in this group
-
-        // iterate over each block in the block group
-        for (int32_t i = 0; i < blocks_in_group; i++)
-        {
-            // read the block bitmap
-            int pos = bgd.bg_block_bitmap * block_size + (i / 8);
-            fh.seekg(pos, std::ios::beg);
-            if (check_istream_state(&fh)) {
-                printf("error: could not seek to block bitmap\n");
-                return 1;
-            }
-            char block_bitmap_byte;
-            fh.read(&block_bitmap_byte, 1);
-            if (check_istream_state(&fh)) {
-                printf("error: could not read data into block bitmap\n");
+        for (const std::string &image : images) {
+            if (!is_image_path(image)) {
+                printf("error: %s is not a .img file or a device\n", image.c_str());
                 return 1;
             }
-            // check if the bit is set
-            if ((block_bitmap_byte & (1 << (i % 8))) == 0)
-            {
-                std::cout << "BFREE," << (i + 1) << std::endl; // TODO: Determine if this `+1` is correct
-            }
         }
-        // iterate over each inode in the block group
-        for (int32_t i = 0; i < inodes_in_group; i++)
-        {
-            // read the block bitmap
-            int pos = bgd.bg_inode_bitmap * block_size + (i / 8);
-            fh.seekg(pos, std::ios::beg);
-            if (check_istream_state(&fh)) {
-                printf("error: could not seek to inode bitmap\n");
-                return 1;
-            }
-            char inode_bitmap_byte;
-            fh.read(&inode_bitmap_byte, 1);
-            if (check_istream_state(&fh)) {
-                printf("error: could not read data into inode bitmap\n");
-                return 1;
-            }
-            // check if the bit is set
-            if ((inode_bitmap_byte & (1 << (i % 8))) == 0)
-            {
-                std::cout << "IFREE," << (i + 1) << std::endl; // TODO: Determine if this `+1` is correct
-            }
+        return hash_files(images, digest, options.use_mmap, options.direct, options.cache_bytes, options.jobs);
+    }
+    // the filters pick records of the full scan, an audit and a layout report need all of them
+    if (options.filtered() && (options.audit || options.layout_report || !options.lookups.empty() ||
+                               options.extract_target != nullptr)) {
+        printf("error: --records, --groups and --inodes can't be used with --audit, --layout-report, "
+               "--lookup or --extract\n");
+        return 1;
+    }
+    if (batch_path != nullptr || images.size() > 1) {
+        // everything that is tied to a single image
+        if (options.stream || options.index_path != nullptr || options.stats || !options.lookups.empty() ||
+            options.extract_target != nullptr || options.layout_report_path != nullptr) {
+            printf("error: --stream, --index, --stats, --lookup, --extract and --layout-report=FILE can't be "
+                   "used with several images\n");
+            return 1;
         }
-
-        // READ the INODE TABLE
-        for (int32_t i = 0; i < inodes_in_group; i++) {
-            // go to the location of the inode table
-            int pos = bgd.bg_inode_table * block_size + (i * sizeof(ext2_inode));
-            fh.seekg(pos, std::ios::beg);
-            if (check_istream_state(&fh)) {
-                printf("error: could not seek to inode table\n");
+        std::set<std::string> output_paths;
+        for (const std::string &image : images) {
+            if (!is_image_path(image)) {
+                printf("error: %s is not a .img file or a device\n", image.c_str());
                 return 1;
             }
-            ext2_inode inode_table;
-            fh.read((char *)&inode_table, sizeof(inode_table));
-            if (check_istream_state(&fh)) {
-                printf("error: could not read data into inode table %i \n",i);
+            if (output_dir != nullptr &&
+                !output_paths.insert(batch_output_path(output_dir, image, options.format)).second) {
+                printf("error: more than one image would be written to %s\n",
+                       batch_output_path(output_dir, image, options.format).c_str());
                 return 1;
             }
-            char file_type = '?';
-            if ((inode_table.i_mode & EXT2_I_MODE_MASK) == EXT2_I_IFDIR) {file_type = 'd';}
-            else if ((inode_table.i_mode & EXT2_I_MODE_MASK) == EXT2_I_IFREG) {file_type = 'f';} 
-            else if ((inode_table.i_mode & EXT2_I_MODE_MASK) == EXT2_I_IFLNK) { file_type = 's';}
-            if (inode_table.i_mode !=0 && inode_table.i_links_count != 0) {
-                std::cout << "INODE," <<
-                    (i + 1) << "," << // inode number (decimal)
-                    file_type << "," <<  // file type ('f' for file, 'd' for directory, 's' for symbolic link, '?" for anything else)
-                    decimal_to_octal(inode_table.i_mode & 0xFFF) << "," << // mode (low order 12-bits, octal ... suggested format "%o")
-                    inode_table.i_uid << "," << // owner (decimal)
-                    inode_table.i_gid << "," << // group (decimal)
-                    inode_table.i_links_count << "," << // link count (decimal)
-                    //TODO: Wording is confusing for what is expected in below field
-                    convert_unix_epoch_to_date(inode_table.i_ctime) << "," << // time of last I-node change (mm/dd/yy hh:mm:ss, GMT)
-                    convert_unix_epoch_to_date(inode_table.i_mtime) << "," << // modification time (mm/dd/yy hh:mm:ss, GMT)
-                    convert_unix_epoch_to_date(inode_table.i_atime) << "," << // time of last access (mm/dd/yy hh:mm:ss, GMT)
-                    inode_table.i_size << "," <<// file size (decimal)
-                    inode_table.i_blocks;// number of (512 byte) blocks of disk space (decimal) taken up by this file
-            
-                /* For ordinary files (type 'f') and directories (type 'd') the next fifteen fields
-                are block addresses (decimal, 12 direct, one indirect, one double indirect, 
-                one triple indirect). */
-                if (file_type == 'f' || file_type == 'd') {
-                    for (int i = 0; i < 15; i++) {
-                        std::cout << "," << inode_table.i_block[i];
-                    }
-                }
-                /* 
-                Symbolic links. If the file length is less than the size of the
-                block pointers (60 bytes) the file will contain zero data blocks,
-                and the name (a text string) is stored in the space normally occupied
-                by the block pointers. This is called an inline symbolic link.
-                2 Cases:
-                1) Inline: in field 13, print the integer that represents the name of the symbolic link
-                2) Non-Inline: In filed 13+, only print non zero blocks
-                */
-                if (file_type == 's') {
-                    if (inode_table.i_size < 60) {
-                        std::cout << "," << inode_table.i_block[0];
-                    } else {
-                        for (int i = 0; i < 15; i++) {
-                            if (inode_table.i_block[i] != 0) {
-                                std::cout << "," << inode_table.i_block[i];
-                            }
-                        }
-                    }
-                }
-                std::cout << std::endl;
-
-                if (file_type == 'd') {
-                    if (!print_directory_entries(inode_table, i, fh)) return 1;
-                }
-
-                // INDIRECT BLOCKS
-                if (file_type == 'd' || file_type == 'f') {
-                    // Initially, the logical offset will be equal to the number of data blocks
-                    int logical_offset = EXT2_NDIR_BLOCKS;
-                    if (inode_table.i_block[EXT2_IND_BLOCK] != 0) {
-                        if (!print_indirect_blocks(inode_table.i_block[EXT2_IND_BLOCK], i, logical_offset, fh)) { return 1; }
-                    }
-                    // update logical offset to be equal the number of data blocks + the
-                    // number of block referenced by indirect blocks
-                    int blocks_referenced_by_indirect_block = block_size / sizeof(__u32);
-                    logical_offset += blocks_referenced_by_indirect_block;
-                    if (inode_table.i_block[EXT2_DIND_BLOCK] != 0) {
-                        if (!print_2nd_indirect_blocks(inode_table.i_block[EXT2_DIND_BLOCK], i, logical_offset, fh)) { return 1; }
-                    }
-                    // update logical offset to be equal the number of data blocks + the
-                    // number of block referenced by single indirect blocks + the number of
-                    // blocks reference by double indirect blocks
-                    logical_offset += std::pow(blocks_referenced_by_indirect_block, 2);
-                    if (inode_table.i_block[EXT2_TIND_BLOCK] != 0) {
-                        if (!print_3rd_indirect_blocks(inode_table.i_block[EXT2_TIND_BLOCK], i, logical_offset, fh)) { return 1; }
-                    }
-
-                }
-
-            }
-
-
         }
+        return scan_batch(images, options, output_dir);
     }
-    return 0;
-}
-
-// main method should take one command line argument, 
-// the path to the image file,
-
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("usage: %s <image file>\n", argv[0]);
+    // check to see that the first command line argument is a .img file,
+    // or a device such as /dev/sdb1
+    std::string image_file_name = argv[argi];
+    struct stat st;
+    // `-` is the image streamed on stdin, as are FIFOs
+    bool is_stream = image_file_name == "-" || (stat(argv[argi], &st) == 0 && S_ISFIFO(st.st_mode));
+    if (!is_stream && !is_image_path(image_file_name)) {
+        printf("error: %s is not a .img file or a device\n", image_file_name.c_str());
         return 1;
     }
-    // check to see that the first command line argument is a .img file
-    std::string image_file_name = argv[1];
-    if (image_file_name.substr(image_file_name.size() - 4) != ".img") {
-        printf("error: %s is not a .img file\n", image_file_name.c_str());
+    stats_enabled = options.stats;
+    if (is_stream || options.stream) {
+        // everything that needs to go back to an earlier block, or to read the
+        // image more than once
+        if (options.jobs > 1 || options.index_path != nullptr || options.audit || options.layout_report ||
+            options.extents || options.prefetch || options.stats || options.direct || !options.lookups.empty() ||
+            options.extract_target != nullptr || options.filtered()) {
+            printf("error: -j, --index, --audit, --layout-report, --extents, --prefetch, --stats, --direct, "
+                   "--lookup, --extract, --records, --groups and --inodes can't be used on a stream\n");
+            return 1;
+        }
+        return stream_ext2_image(argv[argi], options.free_ranges, options.format, options.cache_bytes);
+    }
+    if (options.extract_target != nullptr) {
+        return extract_file(argv[argi], options.extract_target, options.extract_dest,
+                            options.use_mmap, options.direct, options.cache_bytes);
+    }
+    if (!options.lookups.empty()) {
+        block_map_records block_map = !options.lookup_indirect ? block_map_records::none :
+                                      options.extents ? block_map_records::extents :
+                                      block_map_records::indirect;
+        return lookup_paths(argv[argi], options.lookups, block_map,
+                            options.use_mmap, options.direct, options.cache_bytes, options.format);
+    }
+    std::unique_ptr<record_writer> out = make_record_writer(options.format, STDOUT_FILENO);
+    return read_ext2_image(argv[argi], options, *out);
+}
+
+int main(int argc, char *argv[])
+{
+    int result = run(argc, argv);
+    if (output_error() != 0) {
+        std::cerr << "error: could not write the output: " << strerror(output_error()) << std::endl;
         return 1;
     }
-    return read_ext2_image(argv[1]);
-}
\ No newline at end of file
+    return result;
+}
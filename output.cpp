@@ -0,0 +1,107 @@
+#include "output.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+std::atomic<int> first_output_error{0};
+
+} // namespace
+
+void record_output_error(int error)
+{
+    int none = 0;
+    first_output_error.compare_exchange_strong(none, error != 0 ? error : EIO);
+}
+
+int output_error()
+{
+    return first_output_error;
+}
+
+output_sink::output_sink(int fd, size_t capacity)
+    : fd_(fd), capacity_(capacity)
+{
+    buffer_.reserve(capacity_ + 4096);
+}
+
+output_sink::~output_sink()
+{
+    flush();
+}
+
+void output_sink::flush()
+{
+    if (fd_ < 0 || buffer_.empty()) { return; }
+    write_out(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+void output_sink::write_out(const char *data, size_t len)
+{
+    if (error_ != 0) { return; }
+    if (!write_all(fd_, data, len)) {
+        error_ = errno != 0 ? errno : EIO;
+        record_output_error(error_);
+    }
+}
+
+// Two digit field, zero padded
+static inline void put_2digits(char *dst, unsigned value)
+{
+    dst[0] = '0' + value / 10;
+    dst[1] = '0' + value % 10;
+}
+
+output_sink &output_sink::operator<<(gmt_date date)
+{
+    uint32_t day = date.epoch / 86400;
+    uint32_t seconds = date.epoch % 86400;
+    if (day != cached_day_) {
+        // days since 1970-01-01 to a civil (proleptic Gregorian) date,
+        // see http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+        int64_t z = (int64_t)day + 719468;
+        int64_t era = z / 146097;
+        unsigned doe = z - era * 146097;
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int64_t year = yoe + era * 400;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        unsigned mday = doy - (153 * mp + 2) / 5 + 1;
+        unsigned month = mp < 10 ? mp + 3 : mp - 9;
+        if (month <= 2) { year++; }
+        put_2digits(cached_day_text_, month);
+        cached_day_text_[2] = '/';
+        put_2digits(cached_day_text_ + 3, mday);
+        cached_day_text_[5] = '/';
+        put_2digits(cached_day_text_ + 6, year % 100);
+        cached_day_ = day;
+    }
+    char text[17];
+    memcpy(text, cached_day_text_, sizeof(cached_day_text_));
+    text[8] = ' ';
+    put_2digits(text + 9, seconds / 3600);
+    text[11] = ':';
+    put_2digits(text + 12, seconds / 60 % 60);
+    text[14] = ':';
+    put_2digits(text + 15, seconds % 60);
+    append(text, sizeof(text));
+    return *this;
+}
+
+bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef EXT2_OUTPUT_H
+#define EXT2_OUTPUT_H
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// A unix timestamp to be printed as "mm/dd/yy hh:mm:ss" (GMT), the same as
+// strftime's "%D %T"
+struct gmt_date
+{
+    uint32_t epoch;
+};
+
+// Writes all `len` bytes of `data` to `fd`, retrying on short writes
+bool write_all(int fd, const char *data, size_t len);
+
+// Records that writing the output failed with `error` (an errno value)
+void record_output_error(int error);
+// The first error recorded by any writer, 0 if all the output was written.
+// Checked before exiting, so that a full disk or a reader that went away
+// doesn't end in a successful exit status.
+int output_error();
+
+// Buffered writer for the CSV records.
+// Records are appended to a large reusable buffer. Integers are formatted with
+// std::to_chars and dates without going through gmtime/strftime (the date part
+// of the last day printed is cached). A sink attached to a file descriptor
+// writes the buffer with a single write() whenever it fills up, a sink without
+// one just collects the text (e.g. one block group's records) in memory.
+class output_sink
+{
+public:
+    static constexpr size_t default_capacity = 1 << 20;
+
+    explicit output_sink(int fd = -1, size_t capacity = default_capacity);
+    ~output_sink();
+    output_sink(const output_sink &) = delete;
+    output_sink &operator=(const output_sink &) = delete;
+
+    output_sink &operator<<(char c)
+    {
+        buffer_.push_back(c);
+        return *this;
+    }
+    output_sink &operator<<(std::string_view text)
+    {
+        append(text.data(), text.size());
+        return *this;
+    }
+    output_sink &operator<<(const char *text) { return *this << std::string_view(text); }
+
+    // every integer type except `char`, which is printed as a character
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, char>>>
+    output_sink &operator<<(T value)
+    {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        append(digits, result.ptr - digits);
+        return *this;
+    }
+
+    output_sink &operator<<(gmt_date date);
+
+    void append(const char *data, size_t len)
+    {
+        if (fd_ >= 0 && len >= capacity_) {
+            // too big to be worth copying, e.g. a whole block group's records
+            flush();
+            write_out(data, len);
+            return;
+        }
+        buffer_.append(data, len);
+        if (fd_ >= 0 && buffer_.size() >= capacity_) { flush(); }
+    }
+
+    // Writes whatever is buffered to the file descriptor (no-op without one)
+    void flush();
+    // Whether a write to the file descriptor failed; the output after it is dropped
+    bool failed() const { return error_ != 0; }
+
+    // The text collected by a sink without a file descriptor
+    std::string_view text() const { return buffer_; }
+    void clear() { buffer_.clear(); }
+
+private:
+    void write_out(const char *data, size_t len);
+
+    int fd_;
+    int error_ = 0;
+    size_t capacity_;
+    std::string buffer_;
+    // the day number and "mm/dd/yy" text of the last date printed
+    uint32_t cached_day_ = UINT32_MAX;
+    char cached_day_text_[8];
+};
+
+#endif // EXT2_OUTPUT_H
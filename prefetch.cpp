@@ -0,0 +1,93 @@
+#include "prefetch.h"
+
+#include <algorithm>
+
+#include "ext2_fs.h"
+#include "records.h"
+
+uint32_t block_prefetcher::issue()
+{
+    std::sort(blocks_.begin(), blocks_.end());
+    uint32_t ranges = 0;
+    size_t i = 0;
+    while (i < blocks_.size()) {
+        uint32_t first = blocks_[i];
+        uint32_t last = first;
+        while (i < blocks_.size() && blocks_[i] - last <= max_gap) {
+            last = blocks_[i];
+            i++;
+        }
+        image_.prefetch((uint64_t)first * block_size_, (uint64_t)(last - first + 1) * block_size_);
+        ranges++;
+    }
+    blocks_.clear();
+    return ranges;
+}
+
+void prefetch_group_blocks(ext2_image &image, uint32_t block_size, uint64_t inode_table_pos,
+                           uint32_t inode_count, uint32_t inode_stride, bool directories,
+                           bool block_maps)
+{
+    // an indirect block still to be read, and what its pointers lead to
+    struct pending
+    {
+        uint32_t block;
+        int level;
+        bool directory;
+    };
+    // the inode table and indirect blocks are looked at in place, which only
+    // costs nothing when the image is mapped: otherwise each view would be a
+    // read of its own, the table's a second one, so only the table is fetched
+    if (!image.is_mapped()) {
+        image.prefetch(inode_table_pos, (uint64_t)inode_count * inode_stride);
+        return;
+    }
+    block_prefetcher prefetcher(image, block_size);
+    std::vector<pending> frontier;
+    image_view inodes = image.view(inode_table_pos, (uint64_t)inode_count * inode_stride);
+    if (!inodes) { return; }
+    for (uint32_t i = 0; i < inode_count; i++) {
+        const ext2_inode *inode = inodes.at<ext2_inode>((uint64_t)i * inode_stride);
+        if (inode == nullptr) { break; }
+        if (inode->i_mode == 0 || inode->i_links_count == 0) { continue; }
+        char file_type = inode_file_type(*inode);
+        if (file_type != 'd' && file_type != 'f') { continue; }
+        bool dir_blocks = directories && file_type == 'd';
+        if (!dir_blocks && !block_maps) { continue; }
+        // only directories have their data blocks read
+        if (dir_blocks) {
+            for (int b = 0; b < EXT2_NDIR_BLOCKS; b++) {
+                if (inode->i_block[b] != 0) { prefetcher.add(inode->i_block[b]); }
+            }
+        }
+        for (int level = 1; level <= 3; level++) {
+            uint32_t block = inode->i_block[EXT2_IND_BLOCK + level - 1];
+            if (block == 0) { continue; }
+            prefetcher.add(block);
+            frontier.push_back({block, level, dir_blocks});
+        }
+    }
+    prefetcher.issue();
+
+    // the pointers in an indirect block are only known once it has been read,
+    // so every round reads the blocks issued by the previous one
+    uint32_t per_block = block_size / sizeof(__u32);
+    while (!frontier.empty()) {
+        std::sort(frontier.begin(), frontier.end(),
+                  [](const pending &a, const pending &b) { return a.block < b.block; });
+        std::vector<pending> next;
+        for (const pending &p : frontier) {
+            if (p.level == 1 && !p.directory) { continue; }
+            image_view view = image.view((uint64_t)p.block * block_size, block_size);
+            const __u32 *pointers = view.at<__u32>(0, block_size);
+            if (pointers == nullptr) { continue; }
+            for (uint32_t i = 0; i < per_block; i++) {
+                if (pointers[i] == 0) { continue; }
+                prefetcher.add(pointers[i]);
+                if (p.level > 1) { next.push_back({pointers[i], p.level - 1, p.directory}); }
+            }
+        }
+        prefetcher.issue();
+        frontier = std::move(next);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef EXT2_PREFETCH_H
+#define EXT2_PREFETCH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+// Collects block numbers that are about to be read and asks the kernel to
+// read them ahead in disk order, so the scan's scattered block reads are
+// served from the page cache instead of seeking back and forth.
+class block_prefetcher
+{
+public:
+    // blocks at most this far apart are fetched as one range, reading the
+    // gap costs less than another seek
+    static constexpr uint32_t max_gap = 8;
+
+    block_prefetcher(ext2_image &image, uint32_t block_size) : image_(image), block_size_(block_size) {}
+
+    void add(uint32_t block) { blocks_.push_back(block); }
+    // Sorts the collected blocks, merges them into ranges and starts reading
+    // the ranges in the background. Returns the number of ranges issued.
+    uint32_t issue();
+
+private:
+    ext2_image &image_;
+    uint32_t block_size_;
+    std::vector<uint32_t> blocks_;
+};
+
+// Prefetches the directory and indirect blocks the scan of one block group
+// reads for the `inode_count` inodes stored every `inode_stride` bytes from
+// `inode_table_pos`. The indirect tree is fetched a level at a time: the
+// blocks named by the inodes first, then the indirect blocks named by those.
+// `directories` fetches what the DIRENT records are read from (the blocks of
+// directories) and `block_maps` what the INDIRECT records are (the indirect
+// blocks of every file and directory). The walk reads the inode table and
+// indirect blocks through the mapping; when the image isn't mapped only the
+// inode table is fetched ahead.
+void prefetch_group_blocks(ext2_image &image, uint32_t block_size, uint64_t inode_table_pos,
+                           uint32_t inode_count, uint32_t inode_stride, bool directories = true,
+                           bool block_maps = true);
+
+#endif // EXT2_PREFETCH_H
@@ -0,0 +1,228 @@
+#include "records.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+#include "binary_format.h"
+
+char inode_file_type(const ext2_inode &inode)
+{
+    char file_type = '?';
+    if ((inode.i_mode & EXT2_I_MODE_MASK) == EXT2_I_IFDIR) {file_type = 'd';}
+    else if ((inode.i_mode & EXT2_I_MODE_MASK) == EXT2_I_IFREG) {file_type = 'f';}
+    else if ((inode.i_mode & EXT2_I_MODE_MASK) == EXT2_I_IFLNK) { file_type = 's';}
+    return file_type;
+}
+
+std::unique_ptr<record_writer> make_record_writer(record_format format, int fd)
+{
+    if (format == record_format::bin) {
+        return std::make_unique<bin_writer>(fd);
+    }
+    return std::make_unique<csv_writer>(fd);
+}
+
+bool parse_record_kinds(std::string_view list, uint32_t &kinds)
+{
+    static const struct
+    {
+        std::string_view name;
+        uint32_t kind;
+    } names[] = {
+        {"SUPERBLOCK", record_superblock}, {"GROUP", record_group}, {"BFREE", record_bfree},
+        {"IFREE", record_ifree}, {"INODE", record_inode}, {"DIRENT", record_dirent},
+        {"INDIRECT", record_indirect},
+    };
+    kinds = 0;
+    while (true) {
+        size_t comma = list.find(',');
+        std::string_view name = list.substr(0, comma);
+        bool known = false;
+        for (const auto &entry : names) {
+            if (entry.name == name) {
+                kinds |= entry.kind;
+                known = true;
+            }
+        }
+        if (!known) { return false; }
+        if (comma == std::string_view::npos) { return true; }
+        list.remove_prefix(comma + 1);
+    }
+}
+
+// Function to convert decimal number to octal
+int decimal_to_octal(int decimalNumber)
+{
+    int rem, i = 1, octalNumber = 0;
+    while (decimalNumber != 0)
+    {
+        rem = decimalNumber % 8;
+        decimalNumber /= 8;
+        octalNumber += rem * i;
+        i *= 10;
+    }
+    return octalNumber;
+}
+
+void csv_writer::superblock(const ext2_super_block &sb, uint32_t block_size)
+{
+    out_ << "SUPERBLOCK," <<
+                sb.s_blocks_count << "," <<
+                sb.s_inodes_count << "," <<
+                block_size << "," <<
+                sb.s_inode_size << "," <<
+                sb.s_blocks_per_group << "," <<
+                sb.s_inodes_per_group << "," <<
+                sb.s_first_ino << '\n';
+}
+
+void csv_writer::group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+                       const ext2_group_desc &bgd)
+{
+    out_ << "GROUP," <<
+        group << "," <<                                       // group number
+        blocks_in_group << "," <<                             // total number of blocks in this group
+        inodes_in_group << "," <<                             // total number of i-nodes in this group
+        bgd.bg_free_blocks_count << "," << // number of free blocks
+        bgd.bg_free_inodes_count << "," << // number of free i-nodes
+        bgd.bg_block_bitmap << "," <<      // block number of free block bitmap for this group
+        bgd.bg_inode_bitmap << "," <<      // block number of free i-node bitmap for this group
+        bgd.bg_inode_table << '\n';   // block number of first block of i-nodes in this group
+}
+
+void csv_writer::bfree(uint32_t block)
+{
+    out_ << "BFREE," << block << '\n';
+}
+
+void csv_writer::ifree(uint32_t inode)
+{
+    out_ << "IFREE," << inode << '\n';
+}
+
+void csv_writer::bfree_range(uint32_t first, uint32_t count)
+{
+    out_ << "BFREE_RANGE," << first << "," << count << '\n';
+}
+
+void csv_writer::ifree_range(uint32_t first, uint32_t count)
+{
+    out_ << "IFREE_RANGE," << first << "," << count << '\n';
+}
+
+void csv_writer::inode(uint32_t inode_num, const ext2_inode &inode_table)
+{
+    char file_type = inode_file_type(inode_table);
+    out_ << "INODE," <<
+        inode_num << "," << // inode number (decimal)
+        file_type << "," <<  // file type ('f' for file, 'd' for directory, 's' for symbolic link, '?" for anything else)
+        decimal_to_octal(inode_table.i_mode & 0xFFF) << "," << // mode (low order 12-bits, octal ... suggested format "%o")
+        inode_table.i_uid << "," << // owner (decimal)
+        inode_table.i_gid << "," << // group (decimal)
+        inode_table.i_links_count << "," << // link count (decimal)
+        //TODO: Wording is confusing for what is expected in below field
+        gmt_date{inode_table.i_ctime} << "," << // time of last I-node change (mm/dd/yy hh:mm:ss, GMT)
+        gmt_date{inode_table.i_mtime} << "," << // modification time (mm/dd/yy hh:mm:ss, GMT)
+        gmt_date{inode_table.i_atime} << "," << // time of last access (mm/dd/yy hh:mm:ss, GMT)
+        inode_table.i_size << "," <<// file size (decimal)
+        inode_table.i_blocks;// number of (512 byte) blocks of disk space (decimal) taken up by this file
+
+    /* For ordinary files (type 'f') and directories (type 'd') the next fifteen fields
+    are block addresses (decimal, 12 direct, one indirect, one double indirect,
+    one triple indirect). */
+    if (file_type == 'f' || file_type == 'd') {
+        for (int i = 0; i < 15; i++) {
+            out_ << "," << inode_table.i_block[i];
+        }
+    }
+    /*
+    Symbolic links. If the file length is less than the size of the
+    block pointers (60 bytes) the file will contain zero data blocks,
+    and the name (a text string) is stored in the space normally occupied
+    by the block pointers. This is called an inline symbolic link.
+    2 Cases:
+    1) Inline: in field 13, print the integer that represents the name of the symbolic link
+    2) Non-Inline: In filed 13+, only print non zero blocks
+    */
+    if (file_type == 's') {
+        if (inode_table.i_size < 60) {
+            out_ << "," << inode_table.i_block[0];
+        } else {
+            for (int i = 0; i < 15; i++) {
+                if (inode_table.i_block[i] != 0) {
+                    out_ << "," << inode_table.i_block[i];
+                }
+            }
+        }
+    }
+    out_ << '\n';
+}
+
+void csv_writer::dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &dir_entry)
+{
+    out_ << "DIRENT," <<
+                parent << "," << // parent inode number (decimal) ... the I-node number of the directory that contains this entry
+                offset << "," << // logical byte offset (decimal) of this entry within the directory
+                dir_entry.inode << "," << // inode number of the referenced file (decimal)
+                dir_entry.rec_len << "," << // entry length (decimal)
+                // I am not sure why name_len has to be cast to an int to work.
+                (int) dir_entry.name_len << ","; // name length (decimal)
+    // name (string, surrounded by single-quotes). Don't worry about escaping, we promise there will be no single-quotes or commas in any of the file names.
+    out_ << "'";
+    out_.append(dir_entry.name, dir_entry.name_len);
+    out_ << "'\n";
+}
+
+void csv_writer::indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                          uint32_t ind_block, uint32_t block)
+{
+    out_ << "INDIRECT," <<
+                inode_num << "," << // I-node number of the owning file (decimal)
+                level << "," <<// (decimal) level of indirection for the block being scanned ... 1 for single indirect, 2 for double indirect, 3 for triple
+                logical_offset << "," <<// logical block offset (decimal) represented by the referenced block. If the referenced block is a data block, this is the logical block offset of that block within the file. If the referenced block is a single- or double-indirect block, this is the same as the logical offset of the first data block to which it refers.
+                ind_block << "," <<// block number of the (1, 2, 3) indirect block being scanned (decimal) . . . not the highest level block (in the recursive scan), but the lower level block that contains the block reference reported by this entry.
+                block << '\n'; // block number of the referenced block (decimal)
+}
+
+void csv_writer::extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                        uint32_t length)
+{
+    out_ << "EXTENT," <<
+                inode_num << "," <<      // I-node number of the owning file (decimal)
+                logical_start << "," <<  // logical block number of the first block of the run (decimal)
+                physical_start << "," << // block number of the first block of the run (decimal)
+                length << '\n';          // number of blocks in the run (decimal)
+}
+
+void csv_writer::meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length)
+{
+    out_ << "META_EXTENT," <<
+                inode_num << "," <<      // I-node number of the owning file (decimal)
+                physical_start << "," << // block number of the first indirect block of the run (decimal)
+                length << '\n';          // number of indirect blocks in the run (decimal)
+}
+
+void csv_writer::message(std::string_view line)
+{
+    out_ << line;
+}
+
+void csv_writer::append(record_writer &other)
+{
+    output_sink &other_out = static_cast<csv_writer &>(other).out_;
+    out_.append(other_out.text().data(), other_out.text().size());
+    other_out.clear();
+}
+
+bool parse_number(const char *text, uint64_t max, uint64_t &value)
+{
+    // strtoull itself would accept leading spaces and a sign
+    if (!isdigit((unsigned char)*text)) { return false; }
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || n > max) { return false; }
+    value = n;
+    return true;
+}
@@ -0,0 +1,113 @@
+#ifndef EXT2_RECORDS_H
+#define EXT2_RECORDS_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include "ext2_fs.h"
+#include "output.h"
+
+// file type ('f' for file, 'd' for directory, 's' for symbolic link, '?' for anything else)
+char inode_file_type(const ext2_inode &inode);
+
+// The records produced by a scan. `read_ext2_image` describes what it finds
+// through this interface and the concrete writer decides how the records are
+// encoded (CSV text or the binary columnar format).
+// A writer created without a file descriptor buffers its records in memory,
+// which is how the records of one block group are collected by a worker.
+class record_writer
+{
+public:
+    virtual ~record_writer() = default;
+
+    virtual void superblock(const ext2_super_block &sb, uint32_t block_size) = 0;
+    virtual void group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+                       const ext2_group_desc &bgd) = 0;
+    virtual void bfree(uint32_t block) = 0;
+    virtual void ifree(uint32_t inode) = 0;
+    virtual void bfree_range(uint32_t first, uint32_t count) = 0;
+    virtual void ifree_range(uint32_t first, uint32_t count) = 0;
+    virtual void inode(uint32_t inode_num, const ext2_inode &inode) = 0;
+    virtual void dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry) = 0;
+    virtual void indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                          uint32_t ind_block, uint32_t block) = 0;
+    // `--extents`: a run of `length` data blocks starting at `logical_start` in
+    // the file and `physical_start` on disk, or a run of indirect blocks
+    virtual void extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                        uint32_t length) = 0;
+    virtual void meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length) = 0;
+    // A diagnostic line (e.g. "error: ...\n"), kept in order with the records
+    virtual void message(std::string_view line) = 0;
+
+    // Appends the records buffered by `other` (a writer of the same kind
+    // created without a file descriptor) and empties it
+    virtual void append(record_writer &other) = 0;
+    // Writes everything buffered so far to the file descriptor
+    virtual void flush() = 0;
+};
+
+// The record kinds `--records` chooses from, as bits of a mask. BFREE and
+// IFREE also stand for the BFREE_RANGE/IFREE_RANGE runs of `--free-ranges`,
+// and INDIRECT for the EXTENT/META_EXTENT runs of `--extents`.
+enum record_kind : uint32_t
+{
+    record_superblock = 1 << 0,
+    record_group = 1 << 1,
+    record_bfree = 1 << 2,
+    record_ifree = 1 << 3,
+    record_inode = 1 << 4,
+    record_dirent = 1 << 5,
+    record_indirect = 1 << 6,
+    record_all = (1 << 7) - 1,
+};
+
+// Parses a comma separated list of record names (e.g. "INODE,DIRENT") into a
+// mask of `record_kind` bits. Returns false on an unknown name.
+bool parse_record_kinds(std::string_view list, uint32_t &kinds);
+
+// Parses a command line number: decimal digits only, at most `max`. Returns
+// false on anything else (a sign, spaces, trailing characters or overflow).
+bool parse_number(const char *text, uint64_t max, uint64_t &value);
+
+enum class record_format
+{
+    csv,
+    bin,
+};
+
+// Creates a writer for `format` that writes to `fd`, or buffers in memory when `fd` is -1
+std::unique_ptr<record_writer> make_record_writer(record_format format, int fd = -1);
+
+// The CSV records described in the README
+class csv_writer : public record_writer
+{
+public:
+    explicit csv_writer(int fd = -1) : out_(fd) {}
+
+    void superblock(const ext2_super_block &sb, uint32_t block_size) override;
+    void group(int group, int32_t blocks_in_group, int32_t inodes_in_group,
+               const ext2_group_desc &bgd) override;
+    void bfree(uint32_t block) override;
+    void ifree(uint32_t inode) override;
+    void bfree_range(uint32_t first, uint32_t count) override;
+    void ifree_range(uint32_t first, uint32_t count) override;
+    void inode(uint32_t inode_num, const ext2_inode &inode) override;
+    void dirent(uint32_t parent, uint32_t offset, const ext2_dir_entry &entry) override;
+    void indirect(uint32_t inode_num, int level, uint32_t logical_offset,
+                  uint32_t ind_block, uint32_t block) override;
+    void extent(uint32_t inode_num, uint32_t logical_start, uint32_t physical_start,
+                uint32_t length) override;
+    void meta_extent(uint32_t inode_num, uint32_t physical_start, uint32_t length) override;
+    void message(std::string_view line) override;
+
+    void append(record_writer &other) override;
+    void flush() override { out_.flush(); }
+
+    output_sink &sink() { return out_; }
+
+private:
+    output_sink out_;
+};
+
+#endif // EXT2_RECORDS_H
@@ -0,0 +1,306 @@
+#include "serve.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "filesystem.h"
+#include "lookup.h"
+#include "output.h"
+
+namespace {
+
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int) { stop_requested = 1; }
+
+// A request line longer than this closes the connection
+const size_t max_request_bytes = 64 << 10;
+// So does a client that leaves more than this many bytes of replies unread
+const size_t max_output_bytes = 64 << 20;
+
+// An image opened for the lifetime of the server
+struct served_image
+{
+    std::string path;
+    ext2_image image;
+    ext2_layout layout;
+    std::unique_ptr<block_cache> cache;
+    std::unique_ptr<path_resolver> resolver;
+};
+
+struct client
+{
+    int fd;
+    // bytes received after the last whole line
+    std::string input;
+    // replies the socket hasn't taken yet
+    std::string output;
+    // the client sent QUIT, close once `output` is sent
+    bool quitting = false;
+    // the image requests refer to, the first one until `USE`
+    served_image *image;
+};
+
+// The records of one reply. The walkers report errors through `message`,
+// which is kept for the status line instead of going out with the records.
+class reply_writer : public csv_writer
+{
+public:
+    void message(std::string_view line) override
+    {
+        if (error_.empty()) { error_ = line; }
+    }
+
+    std::string take_error()
+    {
+        std::string error = std::move(error_);
+        error_.clear();
+        return error;
+    }
+
+private:
+    std::string error_;
+};
+
+// The inode number `arg` names: a decimal inode number or an absolute path.
+// Returns 0 (with `error` set) if there is no such inode.
+uint32_t find_inode(served_image &image, std::string_view arg, reply_writer &out, std::string &error)
+{
+    if (!arg.empty() && arg[0] == '/') {
+        uint32_t inode_num = image.resolver->resolve(arg, out);
+        if (inode_num == 0) { error = "error: " + std::string(arg) + ": no such file or directory\n"; }
+        return inode_num;
+    }
+    uint64_t inode_num = 0;
+    for (char c : arg) {
+        if (c < '0' || c > '9' || inode_num > UINT32_MAX) {
+            inode_num = 0;
+            break;
+        }
+        inode_num = inode_num * 10 + (c - '0');
+    }
+    if (inode_num == 0 || inode_num > image.layout.sb->s_inodes_count) {
+        error = "error: " + std::string(arg) + ": not an inode number or absolute path\n";
+        return 0;
+    }
+    return inode_num;
+}
+
+// Answers one request line with its records and an "OK" or "error: ..."
+// status line. Returns false when the client asked to close the connection.
+bool answer(client &c, std::string_view line, std::vector<std::unique_ptr<served_image>> &images, bool extents,
+            reply_writer &out)
+{
+    size_t space = line.find(' ');
+    std::string_view command = line.substr(0, space);
+    std::string_view arg = space == std::string_view::npos ? std::string_view() : line.substr(space + 1);
+    served_image &image = *c.image;
+    std::string error;
+    if (command == "QUIT") {
+        return false;
+    } else if (command == "USE") {
+        served_image *found = nullptr;
+        for (auto &candidate : images) {
+            if (candidate->path == arg) { found = candidate.get(); }
+        }
+        if (found == nullptr) {
+            error = "error: " + std::string(arg) + " is not served\n";
+        } else {
+            c.image = found;
+        }
+    } else if (command == "STAT" || command == "LOOKUP" || command == "BLOCKS" || command == "LS") {
+        // LOOKUP is STAT of a path
+        if (command == "LOOKUP" && (arg.empty() || arg[0] != '/')) {
+            error = "error: LOOKUP takes an absolute path\n";
+        }
+        uint32_t inode_num = error.empty() ? find_inode(image, arg, out, error) : 0;
+        ext2_inode inode;
+        if (inode_num != 0 && !read_inode(image.image, image.layout, inode_num, inode)) {
+            error = "error: could not read inode " + std::to_string(inode_num) + "\n";
+        } else if (inode_num != 0 && (inode.i_mode == 0 || inode.i_links_count == 0)) {
+            error = "error: inode " + std::to_string(inode_num) + " is not in use\n";
+        } else if (inode_num != 0) {
+            char file_type = inode_file_type(inode);
+            bool ok = true;
+            if (command == "STAT" || command == "LOOKUP") {
+                out.inode(inode_num, inode);
+            } else if (command == "LS") {
+                if (file_type != 'd') {
+                    error = "error: inode " + std::to_string(inode_num) + " is not a directory\n";
+                } else {
+                    ok = print_directory_entries(inode, inode_num - 1, *image.cache, out);
+                }
+            } else if (file_type == 'd' || file_type == 'f') {
+                ok = extents ? print_extents(inode, inode_num - 1, *image.cache, out)
+                             : print_all_indirect_blocks(inode, inode_num - 1, *image.cache, out);
+            }
+            if (!ok) { error = out.take_error(); }
+        }
+    } else {
+        error = "error: unknown request " + std::string(command) + "\n";
+    }
+    if (error.empty()) {
+        out.sink() << "OK\n";
+    } else {
+        out.sink() << error;
+    }
+    out.take_error();
+    return true;
+}
+
+// Creates the listening socket, replacing a socket file no server is
+// listening on any more. Returns -1 (with a message) on failure.
+int listen_on(const char *socket_path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        std::cerr << "error: socket path " << socket_path << " is too long" << std::endl;
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "error: could not create a socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (const sockaddr *)&addr, sizeof(addr)) == 0) {
+            std::cerr << "error: another server is listening on " << socket_path << std::endl;
+            close(fd);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+    if (bind(fd, (const sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        std::cerr << "error: could not listen on " << socket_path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends as much of the client's pending output as its socket takes without
+// blocking. Returns false if the connection is gone.
+bool send_pending(client &c)
+{
+    size_t sent = 0;
+    while (sent < c.output.size()) {
+        ssize_t n = send(c.fd, c.output.data() + sent, c.output.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) { return false; }
+            break;
+        }
+        sent += n;
+    }
+    c.output.erase(0, sent);
+    return true;
+}
+
+} // namespace
+
+int serve_images(const char *socket_path, const std::vector<std::string> &images, bool use_mmap, bool direct,
+                 size_t cache_bytes, bool extents)
+{
+    std::vector<std::unique_ptr<served_image>> served;
+    for (const std::string &path : images) {
+        auto image = std::make_unique<served_image>();
+        image->path = path;
+        if (!image->image.open(path.c_str(), use_mmap, direct)) {
+            std::cerr << "Could not open file " << path << std::endl;
+            return 1;
+        }
+        // queries read a few scattered blocks
+        image->image.advise(access_hint::random);
+        if (!read_superblock(image->image, image->layout) ||
+            !read_group_descriptors(image->image, image->layout)) {
+            std::cerr << "error: could not read the superblock and group descriptors of " << path << std::endl;
+            return 1;
+        }
+        image->cache = std::make_unique<block_cache>(image->image, image->layout.block_size,
+                                                     cache_bytes / images.size());
+        image->resolver = std::make_unique<path_resolver>(image->image, image->layout, *image->cache);
+        served.push_back(std::move(image));
+    }
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) { return 1; }
+
+    // no SA_RESTART, so that the signal interrupts poll
+    struct sigaction action = {};
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::vector<client> clients;
+    std::vector<pollfd> fds;
+    reply_writer out;
+    char buffer[16 << 10];
+    while (!stop_requested) {
+        fds.assign(1, {listen_fd, POLLIN, 0});
+        // a client is only polled for writing while it has replies waiting
+        for (const client &c : clients) {
+            short events = c.quitting ? POLLOUT : c.output.empty() ? POLLIN : POLLIN | POLLOUT;
+            fds.push_back({c.fd, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) { continue; }
+            std::cerr << "error: poll: " << strerror(errno) << std::endl;
+            break;
+        }
+        // clients are only added and removed after going through `fds`
+        std::vector<client> next;
+        for (size_t i = 0; i < clients.size(); i++) {
+            client &c = clients[i];
+            bool open = true;
+            if ((fds[i + 1].revents & ~POLLOUT) != 0 && !c.quitting) {
+                ssize_t n = read(c.fd, buffer, sizeof(buffer));
+                if (n > 0) {
+                    c.input.append(buffer, n);
+                } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    open = false;
+                }
+            }
+            size_t start = 0;
+            for (size_t end; open && !c.quitting && (end = c.input.find('\n', start)) != std::string::npos;
+                 start = end + 1) {
+                std::string_view line(c.input.data() + start, end - start);
+                if (!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+                c.quitting = !answer(c, line, served, extents, out);
+                c.output += out.sink().text();
+                out.sink().clear();
+            }
+            c.input.erase(0, start);
+            open = open && send_pending(c);
+            // a client that doesn't read its replies can't hold up the others
+            if (c.input.size() > max_request_bytes || c.output.size() > max_output_bytes ||
+                (c.quitting && c.output.empty())) {
+                open = false;
+            }
+            if (open) {
+                next.push_back(std::move(c));
+            } else {
+                close(c.fd);
+            }
+        }
+        clients = std::move(next);
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd >= 0) { clients.push_back({fd, std::string(), std::string(), false, served.front().get()}); }
+        }
+    }
+    for (const client &c : clients) { close(c.fd); }
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
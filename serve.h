@@ -0,0 +1,22 @@
+#ifndef EXT2_SERVE_H
+#define EXT2_SERVE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Answers queries about `images` on the Unix socket `socket_path`
+// (`--serve`). Every image is opened once, with its superblock and group
+// descriptors read in place, and keeps a block cache and the name maps of
+// the directories looked up so far for as long as the server runs, so a
+// query only reads the few blocks it hasn't seen yet.
+// Requests are lines of text, answered with the CSV records of the scan and a
+// status line; the protocol is described in the README. Clients are served
+// one request at a time from a single thread, so the caches need no locks.
+// Runs until SIGINT or SIGTERM, then removes the socket. Returns 1 (with a
+// message on stderr) if an image can't be opened or the socket can't be
+// created, 0 otherwise.
+int serve_images(const char *socket_path, const std::vector<std::string> &images, bool use_mmap, bool direct,
+                 size_t cache_bytes, bool extents);
+
+#endif // EXT2_SERVE_H
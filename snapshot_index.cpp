@@ -0,0 +1,111 @@
+#include "snapshot_index.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "output.h"
+
+namespace {
+
+const char index_magic[8] = {'E', 'X', 'T', '2', 'I', 'D', 'X', '1'};
+
+template <typename T>
+void put(std::string &out, T value)
+{
+    out.append((const char *)&value, sizeof(T));
+}
+
+template <typename T>
+T get(const char *data)
+{
+    T value;
+    memcpy(&value, data, sizeof(T));
+    return value;
+}
+
+size_t padded8(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+} // namespace
+
+void snapshot_index::load(const char *path, uint64_t fingerprint, uint32_t group_count)
+{
+    fingerprint_ = fingerprint;
+    entries_.assign(group_count, entry());
+    if (access(path, F_OK) != 0 || !old_index_.open(path)) { return; }
+    old_data_ = old_index_.view(0, old_index_.size());
+    const image_view &data = old_data_;
+    if (!data || data.size() < 24 || memcmp(data.data(), index_magic, sizeof(index_magic)) != 0 ||
+        get<uint64_t>(data.data() + 8) != fingerprint || get<uint32_t>(data.data() + 16) != group_count) {
+        return;
+    }
+    std::vector<entry> loaded(group_count);
+    size_t pos = 24;
+    for (uint32_t group = 0; group < group_count; group++) {
+        if (data.size() - pos < 24) { return; }
+        uint32_t valid = get<uint32_t>(data.data() + pos);
+        uint64_t hash = get<uint64_t>(data.data() + pos + 8);
+        uint64_t length = get<uint64_t>(data.data() + pos + 16);
+        pos += 24;
+        if (data.size() - pos < length) { return; }
+        loaded[group].valid = valid == 1;
+        loaded[group].hash = hash;
+        loaded[group].records = std::string_view(data.data() + pos, length);
+        pos += padded8(length);
+        if (pos > data.size()) { pos = data.size(); }
+    }
+    entries_ = std::move(loaded);
+}
+
+bool snapshot_index::save(const char *path) const
+{
+    // write a new file and rename it over the old one, so an interrupted run
+    // never leaves a truncated index behind (the old one may still be mapped)
+    std::string tmp_path = std::string(path) + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+    std::string out(index_magic, sizeof(index_magic));
+    put<uint64_t>(out, fingerprint_);
+    put<uint32_t>(out, entries_.size());
+    put<uint32_t>(out, 0);
+    bool ok = true;
+    for (const entry &e : entries_) {
+        put<uint32_t>(out, e.valid ? 1 : 0);
+        put<uint32_t>(out, 0);
+        put<uint64_t>(out, e.hash);
+        put<uint64_t>(out, e.records.size());
+        out.append(e.records.data(), e.records.size());
+        out.append(padded8(e.records.size()) - e.records.size(), '\0');
+        if (out.size() >= output_sink::default_capacity) {
+            ok = ok && write_all(fd, out.data(), out.size());
+            out.clear();
+        }
+    }
+    ok = ok && write_all(fd, out.data(), out.size());
+    ok = close(fd) == 0 && ok;
+    return ok && rename(tmp_path.c_str(), path) == 0;
+}
+
+bool snapshot_index::find(uint32_t group, uint64_t hash, std::string_view &records) const
+{
+    if (group >= entries_.size() || !entries_[group].valid || entries_[group].hash != hash) {
+        return false;
+    }
+    records = entries_[group].records;
+    reused_++;
+    return true;
+}
+
+void snapshot_index::store(uint32_t group, uint64_t hash, std::string records)
+{
+    if (group >= entries_.size()) { return; }
+    entry &e = entries_[group];
+    e.valid = true;
+    e.hash = hash;
+    e.new_records = std::move(records);
+    e.records = e.new_records;
+}
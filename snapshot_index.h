@@ -0,0 +1,58 @@
+#ifndef EXT2_SNAPSHOT_INDEX_H
+#define EXT2_SNAPSHOT_INDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "image.h"
+
+// Sidecar index for incremental rescans (`--index=FILE`).
+// For every block group it keeps a hash of the group's metadata (descriptor,
+// both bitmaps and inode table) and the records the group produced, encoded
+// as a `bin_writer` chunk. A later scan of the same filesystem hashes each
+// group first and replays the saved records of the groups whose hash did
+// not change instead of parsing them again.
+//
+// File layout (little endian): "EXT2IDX1", u64 fingerprint, u32 group count,
+// u32 0, then per group: u32 1 if the entry is valid (0 otherwise), u32 0,
+// u64 hash, u64 record bytes, the records padded to a multiple of 8 bytes.
+class snapshot_index
+{
+public:
+    // Loads `path`. A missing or unreadable file, or one written for a
+    // different `fingerprint` (filesystem layout and scan options) or group
+    // count, leaves the index empty so every group is scanned.
+    void load(const char *path, uint64_t fingerprint, uint32_t group_count);
+    bool save(const char *path) const;
+
+    // Sets `records` to the saved records of `group` if its hash is still `hash`
+    bool find(uint32_t group, uint64_t hash, std::string_view &records) const;
+    // Replaces the entry of `group`. Different groups may be stored concurrently.
+    void store(uint32_t group, uint64_t hash, std::string records);
+
+    uint32_t group_count() const { return entries_.size(); }
+    uint32_t reused() const { return reused_; }
+
+private:
+    struct entry
+    {
+        bool valid = false;
+        uint64_t hash = 0;
+        // points into `old_data_`, or at `new_records`
+        std::string_view records;
+        std::string new_records;
+    };
+
+    uint64_t fingerprint_ = 0;
+    std::vector<entry> entries_;
+    ext2_image old_index_;
+    // the old index, mapped or (when it can't be) read into memory; the
+    // loaded entries point into it, so it lives as long as they do
+    image_view old_data_;
+    mutable std::atomic<uint32_t> reused_{0};
+};
+
+#endif // EXT2_SNAPSHOT_INDEX_H
@@ -0,0 +1,121 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+
+bool stats_enabled = false;
+scan_stats global_stats;
+
+namespace {
+
+const char *phase_names[(int)stat_phase::count] = {
+    "superblock", "group_descriptors", "bitmaps", "inode_table", "directories", "indirect",
+};
+
+// the phase the calling thread is currently charging, and since when
+thread_local stat_phase current_phase = stat_phase::count;
+thread_local uint64_t phase_wall_since = 0;
+thread_local uint64_t phase_cpu_since = 0;
+
+uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double seconds(uint64_t ns)
+{
+    return ns / 1e9;
+}
+
+} // namespace
+
+uint64_t wall_clock_ns()
+{
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+uint64_t thread_cpu_ns()
+{
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+uint64_t process_cpu_ns()
+{
+    return clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void phase_timer::start(stat_phase phase)
+{
+    uint64_t wall = wall_clock_ns(), cpu = thread_cpu_ns();
+    if (current_phase != stat_phase::count) {
+        global_stats.add_phase(current_phase, wall - phase_wall_since, cpu - phase_cpu_since);
+    }
+    previous_ = current_phase;
+    current_phase = phase;
+    phase_wall_since = wall;
+    phase_cpu_since = cpu;
+    active_ = true;
+}
+
+void phase_timer::stop()
+{
+    uint64_t wall = wall_clock_ns(), cpu = thread_cpu_ns();
+    global_stats.add_phase(current_phase, wall - phase_wall_since, cpu - phase_cpu_since);
+    current_phase = previous_;
+    phase_wall_since = wall;
+    phase_cpu_since = cpu;
+}
+
+void scan_stats::report(std::ostream &out) const
+{
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(6);
+    out << "stats: total " << seconds(total_wall_ns_) << " s wall, " << seconds(total_cpu_ns_) << " s cpu\n";
+    out << "stats: phase               wall s      cpu s   (summed over threads)\n";
+    for (int i = 0; i < (int)stat_phase::count; i++) {
+        out << "stats:   " << std::left << std::setw(18) << phase_names[i] << std::right
+            << std::setw(10) << seconds(phase_wall_ns_[i].load()) << " "
+            << std::setw(10) << seconds(phase_cpu_ns_[i].load()) << "\n";
+    }
+    out << "stats: " << syscalls_.load() << " syscalls, " << bytes_read_.load() << " bytes read, "
+        << seeks_.load() << " seeks\n";
+    out << "stats: block cache " << cache_hits_ << " hits, " << cache_misses_ << " misses\n";
+    // the slowest few groups, the JSON report has all of them
+    std::vector<int> order(group_wall_ns_.size());
+    for (size_t i = 0; i < order.size(); i++) { order[i] = i; }
+    size_t shown = std::min<size_t>(order.size(), 5);
+    std::partial_sort(order.begin(), order.begin() + shown, order.end(),
+                      [this](int a, int b) { return group_wall_ns_[a] > group_wall_ns_[b]; });
+    for (size_t i = 0; i < shown; i++) {
+        out << "stats: group " << order[i] << " " << seconds(group_wall_ns_[order[i]]) << " s\n";
+    }
+    out.flags(flags);
+    out.flush();
+}
+
+bool scan_stats::write_json(const char *path) const
+{
+    FILE *f = fopen(path, "w");
+    if (f == nullptr) { return false; }
+    fprintf(f, "{\n  \"wall_seconds\": %.9f,\n  \"cpu_seconds\": %.9f,\n  \"phases\": {\n",
+            seconds(total_wall_ns_), seconds(total_cpu_ns_));
+    for (int i = 0; i < (int)stat_phase::count; i++) {
+        fprintf(f, "    \"%s\": {\"wall_seconds\": %.9f, \"cpu_seconds\": %.9f}%s\n", phase_names[i],
+                seconds(phase_wall_ns_[i].load()), seconds(phase_cpu_ns_[i].load()),
+                i + 1 < (int)stat_phase::count ? "," : "");
+    }
+    fprintf(f, "  },\n  \"syscalls\": %llu,\n  \"bytes_read\": %llu,\n  \"seeks\": %llu,\n",
+            (unsigned long long)syscalls_.load(), (unsigned long long)bytes_read_.load(),
+            (unsigned long long)seeks_.load());
+    fprintf(f, "  \"cache_hits\": %llu,\n  \"cache_misses\": %llu,\n  \"group_wall_seconds\": [",
+            (unsigned long long)cache_hits_, (unsigned long long)cache_misses_);
+    for (size_t i = 0; i < group_wall_ns_.size(); i++) {
+        fprintf(f, "%s%.9f", i == 0 ? "" : ", ", seconds(group_wall_ns_[i]));
+    }
+    fprintf(f, "]\n}\n");
+    return fclose(f) == 0;
+}
@@ -0,0 +1,134 @@
+#ifndef EXT2_STATS_H
+#define EXT2_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counters and phase timers for `--stats`.
+// Everything is switched off unless `stats_enabled` is set before the scan
+// starts; disabled, every hook is a single predictable branch.
+
+extern bool stats_enabled;
+
+enum class stat_phase
+{
+    superblock,
+    group_descriptors,
+    bitmaps,
+    inode_table,
+    directories,
+    indirect,
+    count,
+};
+
+class scan_stats
+{
+public:
+    // An access to `len` bytes of the image at `offset`. `syscalls` is the number
+    // of system calls it took (0 when served from the memory mapping).
+    void count_read(uint64_t offset, uint64_t len, unsigned syscalls)
+    {
+        syscalls_.fetch_add(syscalls, std::memory_order_relaxed);
+        bytes_read_.fetch_add(len, std::memory_order_relaxed);
+        // a read that doesn't continue where the last one ended is a seek
+        if (last_end_.exchange(offset + len, std::memory_order_relaxed) != offset) {
+            seeks_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void count_syscall() { syscalls_.fetch_add(1, std::memory_order_relaxed); }
+
+    void add_phase(stat_phase phase, uint64_t wall_ns, uint64_t cpu_ns)
+    {
+        phase_wall_ns_[(int)phase].fetch_add(wall_ns, std::memory_order_relaxed);
+        phase_cpu_ns_[(int)phase].fetch_add(cpu_ns, std::memory_order_relaxed);
+    }
+    // Must be called before the groups are scanned
+    void set_group_count(int groups) { group_wall_ns_.assign(groups, 0); }
+    // Each group is timed by the one thread that scans it
+    void set_group_time(int group, uint64_t wall_ns)
+    {
+        if (group >= 0 && (size_t)group < group_wall_ns_.size()) { group_wall_ns_[group] = wall_ns; }
+    }
+    void set_cache(uint64_t hits, uint64_t misses)
+    {
+        cache_hits_ = hits;
+        cache_misses_ = misses;
+    }
+    // Wall and process CPU time of the whole run
+    void set_total(uint64_t wall_ns, uint64_t cpu_ns)
+    {
+        total_wall_ns_ = wall_ns;
+        total_cpu_ns_ = cpu_ns;
+    }
+
+    // Human readable report, e.g. for stderr
+    void report(std::ostream &out) const;
+    bool write_json(const char *path) const;
+
+private:
+    std::atomic<uint64_t> syscalls_{0};
+    std::atomic<uint64_t> bytes_read_{0};
+    std::atomic<uint64_t> seeks_{0};
+    std::atomic<uint64_t> last_end_{0};
+    std::atomic<uint64_t> phase_wall_ns_[(int)stat_phase::count] = {};
+    std::atomic<uint64_t> phase_cpu_ns_[(int)stat_phase::count] = {};
+    std::vector<uint64_t> group_wall_ns_;
+    uint64_t cache_hits_ = 0;
+    uint64_t cache_misses_ = 0;
+    uint64_t total_wall_ns_ = 0;
+    uint64_t total_cpu_ns_ = 0;
+};
+
+extern scan_stats global_stats;
+
+uint64_t wall_clock_ns();
+// CPU time of the calling thread
+uint64_t thread_cpu_ns();
+// CPU time of the whole process, all threads
+uint64_t process_cpu_ns();
+
+// Charges the time until it goes out of scope to `phase`. Timers nest: while
+// an inner timer runs, the outer phase is paused, so each phase only counts
+// its own time. Times from several threads add up.
+class phase_timer
+{
+public:
+    explicit phase_timer(stat_phase phase)
+    {
+        if (stats_enabled) { start(phase); }
+    }
+    ~phase_timer()
+    {
+        if (active_) { stop(); }
+    }
+    phase_timer(const phase_timer &) = delete;
+    phase_timer &operator=(const phase_timer &) = delete;
+
+private:
+    void start(stat_phase phase);
+    void stop();
+
+    bool active_ = false;
+    stat_phase previous_ = stat_phase::count;
+};
+
+// Records the wall time until it goes out of scope as the time of `group`
+class group_timer
+{
+public:
+    explicit group_timer(int group) : group_(group), start_(stats_enabled ? wall_clock_ns() : 0) {}
+    ~group_timer()
+    {
+        if (stats_enabled) { global_stats.set_group_time(group_, wall_clock_ns() - start_); }
+    }
+    group_timer(const group_timer &) = delete;
+    group_timer &operator=(const group_timer &) = delete;
+
+private:
+    int group_;
+    uint64_t start_;
+};
+
+#endif // EXT2_STATS_H
@@ -0,0 +1,437 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "bitmap.h"
+#include "filesystem.h"
+
+namespace {
+
+// Reads the input front to back, handing out the next bytes in place
+class byte_stream
+{
+public:
+    explicit byte_stream(int fd) : fd_(fd), buffer_(4 << 20) {}
+
+    // The next `len` bytes, valid until the next call, or nullptr at the end
+    // of the input
+    const char *next(size_t len)
+    {
+        if (end_ - pos_ < len && !fill(len)) { return nullptr; }
+        const char *data = buffer_.data() + pos_;
+        pos_ += len;
+        return data;
+    }
+
+    // Reads what is left, so that the writer of a pipe doesn't get a SIGPIPE
+    void drain()
+    {
+        while (::read(fd_, buffer_.data(), buffer_.size()) > 0 || errno == EINTR) { errno = 0; }
+    }
+
+private:
+    bool fill(size_t len)
+    {
+        if (len > buffer_.size()) { buffer_.resize(len); }
+        memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+        while (end_ < len) {
+            ssize_t n = ::read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return false; }
+            end_ += n;
+        }
+        return true;
+    }
+
+    int fd_;
+    std::vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+// Copies of blocks the stream has already passed. The first `memory_bytes`
+// worth are kept in memory, the rest in an unlinked temporary file.
+class spill_store
+{
+public:
+    spill_store(uint32_t block_size, size_t memory_bytes)
+        : block_size_(block_size), memory_blocks_(memory_bytes / block_size), scratch_(block_size) {}
+    ~spill_store()
+    {
+        if (fd_ >= 0) { close(fd_); }
+    }
+
+    bool put(uint32_t block, const char *data)
+    {
+        if (slots_.size() < memory_blocks_) {
+            slots_[block] = memory_.size() / block_size_;
+            memory_.insert(memory_.end(), data, data + block_size_);
+            return true;
+        }
+        if (fd_ < 0 && !open_file()) { return false; }
+        const char *p = data;
+        size_t left = block_size_;
+        uint64_t offset = file_blocks_ * block_size_;
+        while (left > 0) {
+            ssize_t n = pwrite(fd_, p, left, offset);
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return false; }
+            p += n;
+            left -= n;
+            offset += n;
+        }
+        slots_[block] = memory_blocks_ + file_blocks_++;
+        return true;
+    }
+
+    // The saved copy of `block`, valid until the next call, or nullptr
+    const char *get(uint32_t block)
+    {
+        auto it = slots_.find(block);
+        if (it == slots_.end()) { return nullptr; }
+        if (it->second < memory_blocks_) { return memory_.data() + it->second * block_size_; }
+        uint64_t offset = (it->second - memory_blocks_) * block_size_;
+        if (pread(fd_, scratch_.data(), block_size_, offset) != (ssize_t)block_size_) { return nullptr; }
+        return scratch_.data();
+    }
+
+private:
+    bool open_file()
+    {
+        const char *dir = getenv("TMPDIR");
+        std::string path = std::string(dir != nullptr ? dir : "/tmp") + "/p4exp1-spill-XXXXXX";
+        fd_ = mkstemp(&path[0]);
+        if (fd_ < 0) { return false; }
+        unlink(path.c_str());
+        return true;
+    }
+
+    uint32_t block_size_;
+    uint64_t memory_blocks_;
+    std::vector<char> memory_;
+    std::unordered_map<uint32_t, uint64_t> slots_;
+    int fd_ = -1;
+    uint64_t file_blocks_ = 0;
+    std::vector<char> scratch_;
+};
+
+// What a block of the group metadata is
+struct block_role
+{
+    enum kind_t : uint8_t { block_bitmap, inode_bitmap, inode_table } kind;
+    int group;
+    // inode_table: the index of the block within the table
+    uint32_t index;
+};
+
+// A directory or indirect block that has to be parsed once it is read
+struct block_work
+{
+    enum kind_t : uint8_t { dir_data, indirect } kind;
+    // indirect: 1 single, 2 double, 3 triple
+    uint8_t level;
+    // indirect: the blocks at the bottom of the tree are directory blocks
+    bool dir;
+    uint32_t inode;
+    // logical number of the (first) data block
+    uint32_t logical;
+    // dir_data: the size of the directory
+    uint32_t dir_size;
+};
+
+class stream_scanner
+{
+public:
+    stream_scanner(int fd, record_writer &out, bool free_ranges, size_t spill_bytes)
+        : in_(fd), out_(out), free_ranges_(free_ranges), spill_bytes_(spill_bytes) {}
+
+    bool run();
+
+private:
+    bool read_header(uint32_t &next_block);
+    void handle_block(uint32_t block, const char *data);
+    void handle_role(const block_role &role, const char *data);
+    void handle_inode(uint32_t inode_num, const ext2_inode &inode);
+    // Parses `block` for `work` now if the stream has already reached it,
+    // or once it does
+    void need(uint32_t block, const block_work &work);
+    void process(const block_work &work, uint32_t block, const char *data);
+    void error(const std::string &line)
+    {
+        out_.message(line);
+        failed_ = true;
+    }
+
+    // blocks behind the current one are kept as long as an inode table or an
+    // indirect block that could point back at them is still ahead
+    bool spilling() const { return current_ < last_table_block_ || pending_indirect_ > 0; }
+    bool unclaimed(uint32_t block) const { return (unclaimed_[block / 64] >> (block % 64)) & 1; }
+    void claim(uint32_t block)
+    {
+        if (block < blocks_count_) { unclaimed_[block / 64] &= ~((uint64_t)1 << (block % 64)); }
+    }
+
+    byte_stream in_;
+    record_writer &out_;
+    bool free_ranges_;
+    size_t spill_bytes_;
+    std::vector<char> sb_buffer_;
+    std::vector<char> gdt_buffer_;
+    ext2_layout layout_;
+    uint32_t blocks_count_ = 0;
+    uint32_t per_block_ = 0;
+    std::unordered_map<uint32_t, block_role> roles_;
+    uint32_t last_table_block_ = 0;
+    std::unordered_multimap<uint32_t, block_work> pending_;
+    uint64_t pending_indirect_ = 0;
+    // one bit per block: allocated (or not known to be free yet) and not known
+    // to hold file data, so it may turn out to be a directory or indirect block
+    std::vector<uint64_t> unclaimed_;
+    std::unique_ptr<spill_store> spill_;
+    uint32_t current_ = 0;
+    const char *current_data_ = nullptr;
+    bool failed_ = false;
+};
+
+bool stream_scanner::read_header(uint32_t &next_block)
+{
+    // the boot block and the superblock
+    const char *head = in_.next(2 * BYTES_PRE_SUPER_BLOCK);
+    if (head != nullptr) { sb_buffer_.assign(head + BYTES_PRE_SUPER_BLOCK, head + 2 * BYTES_PRE_SUPER_BLOCK); }
+    if (head == nullptr || !set_superblock(layout_, image_view(sb_buffer_.data(), sb_buffer_.size()))) {
+        out_.message("error: could not read superblock\n");
+        return false;
+    }
+    const ext2_super_block &sb = *layout_.sb;
+    out_.superblock(sb, layout_.block_size);
+    uint64_t consumed = 2 * BYTES_PRE_SUPER_BLOCK;
+    if (consumed % layout_.block_size != 0) {
+        if (in_.next(layout_.block_size - consumed % layout_.block_size) == nullptr) {
+            out_.message("error: could not read block group descriptor table\n");
+            return false;
+        }
+        consumed += layout_.block_size - consumed % layout_.block_size;
+    }
+    next_block = consumed / layout_.block_size;
+
+    // the group descriptor table starts in the block after the superblock
+    uint64_t gdt_len = (uint64_t)layout_.group_count * sizeof(ext2_group_desc);
+    uint32_t gdt_blocks = (gdt_len + layout_.block_size - 1) / layout_.block_size;
+    const char *gdt = in_.next((size_t)gdt_blocks * layout_.block_size);
+    if (gdt == nullptr) {
+        out_.message("error: could not read block group descriptor table\n");
+        return false;
+    }
+    gdt_buffer_.assign(gdt, gdt + gdt_len);
+    layout_.gdt_view = image_view(gdt_buffer_.data(), gdt_buffer_.size());
+    next_block += gdt_blocks;
+
+    blocks_count_ = sb.s_blocks_count;
+    per_block_ = layout_.block_size / sizeof(__u32);
+    uint32_t stride = inode_size(sb);
+    for (int group = 0; group < layout_.group_count; group++) {
+        const ext2_group_desc &bgd = layout_.group_desc(group);
+        roles_[bgd.bg_block_bitmap] = {block_role::block_bitmap, group, 0};
+        roles_[bgd.bg_inode_bitmap] = {block_role::inode_bitmap, group, 0};
+        uint32_t table_blocks = ((uint64_t)group_inode_count(sb, group) * stride + layout_.block_size - 1) / layout_.block_size;
+        for (uint32_t i = 0; i < table_blocks; i++) {
+            roles_[bgd.bg_inode_table + i] = {block_role::inode_table, group, i};
+        }
+        last_table_block_ = std::max(last_table_block_, bgd.bg_inode_table + table_blocks - 1);
+        if (std::min(bgd.bg_block_bitmap, std::min(bgd.bg_inode_bitmap, bgd.bg_inode_table)) < next_block) {
+            error("error: the metadata of group " + std::to_string(group) + " lies before the end of the "
+                  "group descriptor table\n");
+        }
+    }
+    unclaimed_.assign((blocks_count_ + 63) / 64, ~(uint64_t)0);
+    spill_ = std::make_unique<spill_store>(layout_.block_size, spill_bytes_);
+    return true;
+}
+
+bool stream_scanner::run()
+{
+    uint32_t block = 0;
+    if (!read_header(block)) {
+        in_.drain();
+        out_.flush();
+        return false;
+    }
+    for (; block < blocks_count_; block++) {
+        const char *data = in_.next(layout_.block_size);
+        if (data == nullptr) {
+            error("error: the image ended at block " + std::to_string(block) + "\n");
+            break;
+        }
+        handle_block(block, data);
+    }
+    current_data_ = nullptr;
+    if (!pending_.empty()) {
+        error("error: " + std::to_string(pending_.size()) + " directory or indirect blocks were never reached\n");
+    }
+    in_.drain();
+    out_.flush();
+    return !failed_;
+}
+
+void stream_scanner::handle_block(uint32_t block, const char *data)
+{
+    current_ = block;
+    current_data_ = data;
+    auto role = roles_.find(block);
+    if (role != roles_.end()) {
+        handle_role(role->second, data);
+    }
+    auto range = pending_.equal_range(block);
+    if (range.first != range.second) {
+        std::vector<block_work> works;
+        for (auto it = range.first; it != range.second; ++it) { works.push_back(it->second); }
+        pending_.erase(range.first, range.second);
+        for (const block_work &work : works) {
+            if (work.kind == block_work::indirect) { pending_indirect_--; }
+            process(work, block, data);
+        }
+    } else if (role == roles_.end() && spilling() && unclaimed(block)) {
+        if (!spill_->put(block, data)) {
+            error("error: could not save block " + std::to_string(block) + " to a temporary file\n");
+        }
+    }
+}
+
+void stream_scanner::handle_role(const block_role &role, const char *data)
+{
+    const ext2_super_block &sb = *layout_.sb;
+    const ext2_group_desc &bgd = layout_.group_desc(role.group);
+    switch (role.kind) {
+        case block_role::block_bitmap: {
+            int32_t blocks_in_group = group_block_count(sb, role.group);
+            uint32_t first_block = group_first_block(sb, role.group);
+            out_.group(role.group, blocks_in_group, group_inode_count(sb, role.group), bgd);
+            print_free_blocks(data, blocks_in_group, first_block, free_ranges_, out_);
+            // free blocks can't be directory or indirect blocks, don't keep them
+            for_each_free_bit(data, blocks_in_group, [&](uint32_t i) { claim(first_block + i); });
+            break;
+        }
+        case block_role::inode_bitmap:
+            print_free_inodes(data, group_inode_count(sb, role.group), sb.s_inodes_per_group * role.group,
+                              free_ranges_, out_);
+            break;
+        case block_role::inode_table: {
+            uint32_t stride = inode_size(sb);
+            uint32_t inodes = group_inode_count(sb, role.group);
+            uint32_t first = role.index * (layout_.block_size / stride);
+            for (uint32_t i = first; i < inodes && i < first + layout_.block_size / stride; i++) {
+                ext2_inode inode;
+                memcpy(&inode, data + (size_t)(i - first) * stride, sizeof(inode));
+                handle_inode(sb.s_inodes_per_group * role.group + i + 1, inode);
+            }
+            break;
+        }
+    }
+}
+
+void stream_scanner::handle_inode(uint32_t inode_num, const ext2_inode &inode)
+{
+    if (inode.i_mode == 0 || inode.i_links_count == 0) { return; }
+    out_.inode(inode_num, inode);
+    char file_type = inode_file_type(inode);
+    if (file_type != 'd' && file_type != 'f') { return; }
+    bool dir = file_type == 'd';
+    for (int i = 0; i < EXT2_NDIR_BLOCKS; i++) {
+        if (inode.i_block[i] == 0) { continue; }
+        if (dir) {
+            need(inode.i_block[i], {block_work::dir_data, 0, true, inode_num, (uint32_t)i, inode.i_size});
+        } else {
+            claim(inode.i_block[i]);
+        }
+    }
+    for (int level = 1; level <= 3; level++) {
+        uint32_t ind_block = inode.i_block[EXT2_IND_BLOCK + level - 1];
+        if (ind_block != 0) {
+            need(ind_block, {block_work::indirect, (uint8_t)level, dir, inode_num,
+                             (uint32_t)indirect_tree_start(per_block_, level), inode.i_size});
+        }
+    }
+}
+
+void stream_scanner::need(uint32_t block, const block_work &work)
+{
+    if (block >= blocks_count_) {
+        error("error: block " + std::to_string(block) + " of inode " + std::to_string(work.inode) +
+              " lies outside the image\n");
+        return;
+    }
+    if (block > current_) {
+        pending_.emplace(block, work);
+        if (work.kind == block_work::indirect) { pending_indirect_++; }
+        return;
+    }
+    const char *data = block == current_ ? current_data_ : spill_->get(block);
+    if (data == nullptr) {
+        error("error: block " + std::to_string(block) + " of inode " + std::to_string(work.inode) +
+              " was needed after the stream had passed it\n");
+        return;
+    }
+    process(work, block, data);
+}
+
+void stream_scanner::process(const block_work &work, uint32_t block, const char *data)
+{
+    if (work.kind == block_work::dir_data) {
+        uint64_t start = (uint64_t)work.logical * layout_.block_size;
+        bool ok = for_each_block_entry(image_view(data, layout_.block_size), start, work.dir_size,
+            [&](uint64_t offset, const ext2_dir_entry &entry) { out_.dirent(work.inode, offset, entry); });
+        if (!ok) { error("error: could not read data into directory data block\n"); }
+        return;
+    }
+    // copied, as the blocks below may come from the spill store, which reuses
+    // its buffer
+    std::vector<__u32> pointers(per_block_);
+    memcpy(pointers.data(), data, layout_.block_size);
+    const uint64_t span = indirect_span(per_block_, work.level);
+    for (uint32_t i = 0; i < per_block_; i++) {
+        if (pointers[i] == 0) { continue; }
+        uint64_t first = work.logical + i * span;
+        if (!valid_logical_block(first)) {
+            error("error: indirect block " + std::to_string(block) + " maps blocks past the last logical block\n");
+            return;
+        }
+        out_.indirect(work.inode, work.level, (uint32_t)first, block, pointers[i]);
+        if (work.level > 1) {
+            need(pointers[i], {block_work::indirect, (uint8_t)(work.level - 1), work.dir, work.inode,
+                               (uint32_t)first, work.dir_size});
+        } else if (work.dir) {
+            need(pointers[i], {block_work::dir_data, 0, true, work.inode, (uint32_t)first, work.dir_size});
+        } else {
+            claim(pointers[i]);
+        }
+    }
+}
+
+} // namespace
+
+int stream_ext2_image(const char *in_file, bool free_ranges, record_format format, size_t spill_bytes)
+{
+    int fd = strcmp(in_file, "-") == 0 ? STDIN_FILENO : open(in_file, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open file" << std::endl;
+        return 1;
+    }
+    std::unique_ptr<record_writer> out = make_record_writer(format, STDOUT_FILENO);
+    stream_scanner scanner(fd, *out, free_ranges, spill_bytes);
+    bool ok = scanner.run();
+    if (fd != STDIN_FILENO) { close(fd); }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef EXT2_STREAM_H
+#define EXT2_STREAM_H
+
+#include <cstddef>
+
+#include "records.h"
+
+// Scans an image that can only be read once, front to back, such as a pipe
+// (`-` reads stdin). The superblock and group descriptors are read first, and
+// every later block is handled when the stream reaches it: bitmaps and inode
+// tables as they come, directory and indirect blocks once an inode (or
+// indirect block) has said they are needed. Allocated blocks that go by before
+// anything has claimed them are kept, up to `spill_bytes` in memory and then
+// in an unlinked temporary file, in case a later inode or indirect block
+// points back at them.
+// The records are the same as those of `read_ext2_image`, but in the order the
+// blocks they come from appear in the stream. Returns 1 (with a message) on
+// failure, 0 otherwise.
+int stream_ext2_image(const char *in_file, bool free_ranges, record_format format, size_t spill_bytes);
+
+#endif // EXT2_STREAM_H
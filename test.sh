@@ -1,23 +1,183 @@
 #!/bin/bash
 #
 # functionality check script for Project 4A
+#
+#   ./test.sh IMAGE EXPECTED [OPTIONS...]   compare `./p4exp1 OPTIONS... IMAGE` with EXPECTED
+#   ./test.sh                               check every fixture in test_data
 
 # compile the executable `p4exp1`
 make
-# Run the executable `p4exp1` with the first argument as the input file
-# pipe the output to a file `test.csv`
-echo $1
-echo $2
-./p4exp1 $1 > test.csv
-# if the second argument is not a file, exit with an error
-if [ ! -f $2 ]; then
-    echo "Input file $2 does not exist"
+
+# Runs the command given after the first argument and compares its sorted
+# output with the file given as the first argument
+run_command() {
+    local expected=$1
+    shift
+    echo $*
+    echo $expected
+    # if the expected output is not a file, exit with an error
+    if [ ! -f $expected ]; then
+        echo "Input file $expected does not exist"
+        return 1
+    fi
+    "$@" > test.csv
+    # compare the output `test.csv` with the expected output
+    diff <(sort $expected) <(sort test.csv)
+    local status=$?
+    # remove the temporary file
     rm test.csv
-    exit 1
-fi
+    return $status
+}
+
+# Runs `p4exp1` with the options after the first two arguments on the image
+# given as the first argument, and compares its sorted output with the file
+# given as the second argument
+run_case() {
+    local image=$1 expected=$2
+    shift 2
+    run_command $expected ./p4exp1 "$@" $image
+}
+
+# Prints `p4exp1 --format=bin` output converted back to CSV by `ext2_bin2csv`
+bin_round_trip() {
+    ./p4exp1 --format=bin "$@" > test.bin && ./ext2_bin2csv test.bin
+    local status=$?
+    rm -f test.bin
+    return $status
+}
+
+# Scans once with `--index` to build the index, then prints the records of a
+# second scan, which must replay every group from the index (otherwise its
+# report is printed along with the records, so they don't match)
+index_rescan() {
+    rm -f test.idx
+    ./p4exp1 --index=test.idx "$@" > /dev/null 2>&1
+    ./p4exp1 --index=test.idx "$@" 2> test.log
+    grep -Eq '^index: ([0-9]+) of \1 groups unchanged$' test.log || cat test.log
+    rm -f test.idx test.log
+}
+
+# Prints the SHA-256 digest of every target after the options given as the
+# first argument (e.g. "--no-mmap", or ""), extracted from the image given as
+# the second argument with `--extract`
+extract_digests() {
+    local options=$1 image=$2
+    shift 2
+    for target in "$@"; do
+        ./p4exp1 $options --extract $target test.out $image && echo "$(sha256sum < test.out | cut -d' ' -f1)  $target"
+    done
+    rm -f test.out
+}
 
-# compare the output `test.csv` with the second argument
-diff <(sort $2) <(sort test.csv)
+# Prints the `--audit` report of `p4exp1` run with the given arguments
+audit_report() {
+    ./p4exp1 --audit "$@" 2>&1 > /dev/null
+}
 
-# remove the temporary file
-rm test.csv
\ No newline at end of file
+# Prints the records of the image given as the first argument, read by
+# `p4exp1` from a pipe
+scan_pipe() {
+    cat "$1" | ./p4exp1 -
+}
+
+# Starts `p4exp1 --serve` on the images given as arguments, sends it the
+# requests in test_data/serve_requests.txt on one connection and prints the
+# replies
+serve_replies() {
+    rm -f test.sock
+    ./p4exp1 --serve test.sock "$@" &
+    local server=$!
+    for i in $(seq 50); do
+        [ -S test.sock ] && break
+        sleep 0.1
+    done
+    python3 -c '
+import socket, sys
+client = socket.socket(socket.AF_UNIX)
+client.connect(sys.argv[1])
+client.sendall(sys.stdin.buffer.read())
+while True:
+    data = client.recv(65536)
+    if not data:
+        break
+    sys.stdout.buffer.write(data)
+' test.sock < test_data/serve_requests.txt
+    kill $server
+    wait $server
+}
+
+# Prints the `--layout-report` that `p4exp1` run with the given arguments writes to a file
+layout_report() {
+    ./p4exp1 --layout-report=test.txt "$@" > /dev/null && cat test.txt
+    rm -f test.txt
+}
+
+if [ $# -ge 2 ]; then
+    run_case "$@"
+    exit
+fi
+
+status=0
+run_case test_data/trivial.img test_data/trivial.csv || status=1
+# a file reaching its double and triple indirect blocks, with holes
+run_case test_data/indirect.img test_data/indirect.csv || status=1
+# 64K blocks, and a triple indirect pointer whose logical block doesn't fit in 32 bits
+run_case test_data/tind64k.img test_data/tind64k.csv || status=1
+run_case test_data/tind64k.img test_data/tind64k.csv --stream || status=1
+# several block groups, 1K and 4K blocks, the last group partial
+for image in multi1k multi4k; do
+    run_case test_data/$image.img test_data/$image.csv || status=1
+    run_case test_data/$image.img test_data/$image.csv -j 4 || status=1
+done
+# the forward-only scan, of a file and of a pipe
+for image in trivial indirect multi1k multi4k; do
+    run_case test_data/$image.img test_data/$image.csv --stream || status=1
+    run_command test_data/$image.csv scan_pipe test_data/$image.img || status=1
+done
+run_case test_data/multi1k.img test_data/multi1k_groups.csv --records=GROUP,INODE,DIRENT,INDIRECT --groups 1-2 || status=1
+run_case test_data/multi1k.img test_data/multi1k_groups.csv -j 3 --records=GROUP,INODE,DIRENT,INDIRECT --groups 1-2 || status=1
+run_case test_data/multi4k.img test_data/multi4k_inodes.csv --records=IFREE,INODE,INDIRECT --inodes 20-40 || status=1
+run_case test_data/multi4k.img test_data/multi4k_inodes.csv -j 2 --records=IFREE,INODE,INDIRECT --inodes 20-40 || status=1
+# free blocks and inodes as runs
+run_case test_data/multi4k.img test_data/multi4k_ranges.csv --free-ranges || status=1
+run_case test_data/multi4k.img test_data/multi4k_ranges.csv -j 4 --free-ranges || status=1
+# block maps as runs of blocks, holes and indirect blocks included
+run_case test_data/indirect.img test_data/indirect_extents.csv --extents || status=1
+run_case test_data/multi1k.img test_data/multi1k_extents.csv --extents || status=1
+run_case test_data/multi1k.img test_data/multi1k_extents.csv -j 4 --extents || status=1
+# files copied out by path and by inode number, sparse and reaching their triple indirect blocks
+run_command test_data/extract.sha256 extract_digests "" test_data/indirect.img /tind /dind /small 13 || status=1
+run_command test_data/extract.sha256 extract_digests --no-mmap test_data/indirect.img /tind /dind /small 13 || status=1
+# the INODE and INDIRECT records of a few paths, and an error for a missing one
+run_case test_data/multi1k.img test_data/multi1k_lookup.csv --lookup /a/f2 --lookup /c/dind --lookup /c/link --lookup /a/f5 --indirect || status=1
+run_case test_data/multi1k.img test_data/multi1k_lookup.csv --no-mmap --lookup /a/f2 --lookup /c/dind --lookup /c/link --lookup /a/f5 --indirect || status=1
+# the binary format, converted back to the same CSV
+run_command test_data/indirect.csv bin_round_trip test_data/indirect.img || status=1
+run_command test_data/multi1k.csv bin_round_trip -j 4 test_data/multi1k.img || status=1
+run_command test_data/multi4k_ranges.csv bin_round_trip --free-ranges test_data/multi4k.img || status=1
+# a rescan replaying the records saved in the index
+run_command test_data/multi1k.csv index_rescan test_data/multi1k.img || status=1
+run_command test_data/multi4k.csv index_rescan --no-mmap -j 4 test_data/multi4k.img || status=1
+# a block used twice, bitmaps, free counts and a link count that don't match
+run_command test_data/audit_bad.txt audit_report test_data/audit_bad.img || status=1
+run_command test_data/audit_bad.txt audit_report -j 2 --no-mmap test_data/audit_bad.img || status=1
+# fragments of files with holes and with indirect blocks allocated between their data blocks
+run_command test_data/indirect_layout.txt layout_report test_data/indirect.img || status=1
+run_command test_data/multi1k_layout.txt layout_report test_data/multi1k.img || status=1
+run_command test_data/multi1k_layout.txt layout_report -j 4 test_data/multi1k.img || status=1
+# digests of the files' contents, holes and all
+run_case test_data/indirect.img test_data/indirect_sha256.csv --hash-files=sha256 || status=1
+run_case test_data/indirect.img test_data/indirect_sha256.csv --no-mmap --hash-files=sha256 || status=1
+run_case test_data/multi1k.img test_data/multi1k_xxh64.csv --hash-files || status=1
+run_case test_data/multi1k.img test_data/multi1k_xxh64.csv -j 4 --hash-files=xxh64 || status=1
+# entries removed and added without the directories' inodes or the bitmaps changing
+run_case test_data/diff_new.img test_data/diff_new.csv --diff test_data/multi1k.img || status=1
+run_case test_data/diff_new.img test_data/diff_new.csv -j 4 --diff test_data/multi1k.img || status=1
+run_case test_data/diff_new.img test_data/diff_new.csv --no-mmap --diff test_data/multi1k.img || status=1
+# a server session across two images, errors included
+if command -v python3 > /dev/null; then
+    run_command test_data/serve.csv serve_replies test_data/indirect.img test_data/multi1k.img || status=1
+else
+    echo "python3 not found, --serve not checked"
+fi
+exit $status
@@ -0,0 +1,84 @@
+#ifndef EXT2_THREAD_POOL_H
+#define EXT2_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed size pool of worker threads that run tasks in submission order.
+// Every task is handed the index of the worker running it (0 .. size()-1) so
+// it can use per-worker state such as a block cache without locking.
+class thread_pool
+{
+public:
+    explicit thread_pool(unsigned threads)
+    {
+        if (threads == 0) { threads = 1; }
+        for (unsigned i = 0; i < threads; i++) {
+            workers_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    // Finishes every queued task before joining the workers
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_ready_.notify_all();
+        for (auto &worker : workers_) { worker.join(); }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    unsigned size() const { return workers_.size(); }
+
+    void submit(std::function<void(unsigned worker)> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        work_ready_.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        all_idle_.wait(lock, [this] { return tasks_.empty() && running_ == 0; });
+    }
+
+private:
+    void run(unsigned worker)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) { return; }
+            auto task = std::move(tasks_.front());
+            tasks_.pop_front();
+            running_++;
+            lock.unlock();
+            task(worker);
+            lock.lock();
+            running_--;
+            if (tasks_.empty() && running_ == 0) { all_idle_.notify_all(); }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void(unsigned)>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable all_idle_;
+    unsigned running_ = 0;
+    bool stopping_ = false;
+};
+
+#endif // EXT2_THREAD_POOL_H